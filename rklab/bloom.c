@@ -10,6 +10,7 @@
 #include <stdio.h>
 
 #include "rkgrep.h"
+#include "rkstats.h"
 
 /* Constants for bloom filter implementation */
 const int H1PRIME = 4189793;
@@ -72,6 +73,40 @@ bloom_query(bloom_filter *f,
 	return false;
 }
 
+/* Query n elements at once, storing whether elms[i] is in the bloom filter in out[i].
+ * A single bloom_query stalls on up to BLOOM_HASH_NUM cache misses, one after another.
+ * Instead, we compute the bitmap positions of a block of BLOOM_BATCH elements up front
+ * and prefetch all of them, so that the misses are outstanding at the same time by the
+ * time we test the bits. The answers are identical to calling bloom_query on each element.
+ */
+void
+bloom_query_batch(bloom_filter *bf, const long long *elms, int n, bool *out)
+{
+	int pos[BLOOM_BATCH * BLOOM_HASH_NUM];
+
+	for (int start = 0; start < n; start += BLOOM_BATCH) {
+		int cnt = (n - start) < BLOOM_BATCH ? (n - start) : BLOOM_BATCH;
+		// pass 1: compute every probe position and issue a prefetch for it
+		for (int j = 0; j < cnt; j++) {
+			for (int i = 0; i < BLOOM_HASH_NUM; i++) {
+				int p = hash_i(i, elms[start+j]) % bf->bsz;
+				pos[j*BLOOM_HASH_NUM + i] = p;
+				__builtin_prefetch(&bf->buf[p >> 3], 0, 0);
+			}
+		}
+		// pass 2: test the bits, which should now be (or soon be) in cache
+		for (int j = 0; j < cnt; j++) {
+			bool found = true;
+			for (int i = 0; i < BLOOM_HASH_NUM; i++) {
+				int p = pos[j*BLOOM_HASH_NUM + i];
+				found &= (bf->buf[p >> 3] >> (7 - (p & 7))) & 1;
+			}
+			out[start+j] = found;
+		}
+	}
+	RK_STAT_ADD(filter_probes, (long)n * BLOOM_HASH_NUM);
+}
+
 void 
 bloom_free(bloom_filter *bf)
 {
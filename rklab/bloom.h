@@ -3,6 +3,9 @@
 
 #include <stdbool.h>
 
+/* number of queries whose probes are prefetched together by bloom_query_batch */
+#define BLOOM_BATCH 16
+
 typedef struct {
 	char *buf; /* the bitmap representing the bloom filter*/
 	int bsz; /* size of bitmap in bits*/
@@ -14,6 +17,7 @@ int hash_i(int i, long long x);
 
 void bloom_add(bloom_filter *f, long long elm);
 bool bloom_query(bloom_filter *f, long long elm);
+void bloom_query_batch(bloom_filter *f, const long long *elms, int n, bool *out);
 
 bool bloom_bit_at_pos(bloom_filter *f, int pos);
 
@@ -0,0 +1,233 @@
+/***********************************************************
+ File Name: cuckoo.c
+ Description: cuckoo filter, an alternative to the bloom filter
+ **********************************************************/
+
+#include <assert.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "cuckoo.h"
+#include "rkstats.h"
+
+/* how many times cuckoo_add relocates existing fingerprints before giving up */
+#define CUCKOO_MAX_KICKS 500
+
+/* a cuckoo filter stays below this load factor (in percent) when sized by cuckoo_init */
+#define CUCKOO_LOAD_PCT 95
+
+/* A cuckoo filter stores a small fingerprint of each element in one of two candidate
+ * buckets. The second bucket is computed from the first bucket and the fingerprint
+ * alone (partial-key cuckoo hashing), so a fingerprint can be moved to its alternate
+ * bucket without knowing the original element. A query examines exactly two buckets
+ * (two cache lines at most), and an element can be removed by deleting its fingerprint.
+ * With 16-bit fingerprints and 4-slot buckets, the false positive rate is about
+ * 2*CUCKOO_BUCKET_SIZE/2^16 (~0.012%), and the filter takes 16/load bits per element,
+ * i.e. ~17 bits when it is filled to CUCKOO_LOAD_PCT. cuckoo_init rounds the number of
+ * buckets up to a power of 2, though, so a filter sized for n elements can take up to
+ * twice that (about 21 bits per element in rkgrep_test -a cuckoo).
+ */
+
+// mix64 scrambles all bits of x (the splitmix64 finalizer)
+static inline unsigned long long
+mix64(unsigned long long x)
+{
+	x ^= x >> 30;
+	x *= 0xbf58476d1ce4e5b9ULL;
+	x ^= x >> 27;
+	x *= 0x94d049bb133111ebULL;
+	x ^= x >> 31;
+	return x;
+}
+
+// alt_bucket returns the other candidate bucket of fingerprint fp stored in bucket i
+static inline int
+alt_bucket(cuckoo_filter *cf, int i, uint16_t fp)
+{
+	return (i ^ (int)(fp * 0x5bd1e995U)) & (cf->nbuckets - 1);
+}
+
+// cuckoo_index computes the fingerprint and the first candidate bucket of elm
+static inline void
+cuckoo_index(cuckoo_filter *cf, long long elm, uint16_t *fp, int *i1)
+{
+	unsigned long long h = mix64((unsigned long long)elm);
+	*i1 = (int)(h & (cf->nbuckets - 1));
+	*fp = (uint16_t)(h >> 48);
+	if (*fp == 0) {
+		*fp = 1; // 0 marks an empty slot
+	}
+}
+
+// bucket_has returns whether bucket i contains fp, testing all 4 slots at once
+static inline bool
+bucket_has(cuckoo_filter *cf, int i, uint16_t fp)
+{
+	unsigned long long b;
+	memcpy(&b, &cf->buf[i*CUCKOO_BUCKET_SIZE], sizeof(b));
+	// a 16-bit lane of v is zero iff that slot holds fp
+	unsigned long long v = b ^ (fp * 0x0001000100010001ULL);
+	return ((v - 0x0001000100010001ULL) & ~v & 0x8000800080008000ULL) != 0;
+}
+
+// bucket_insert stores fp in a free slot of bucket i and returns true, or returns false if the bucket is full
+static inline bool
+bucket_insert(cuckoo_filter *cf, int i, uint16_t fp)
+{
+	uint16_t *b = &cf->buf[i*CUCKOO_BUCKET_SIZE];
+	for (int j = 0; j < CUCKOO_BUCKET_SIZE; j++) {
+		if (b[j] == 0) {
+			b[j] = fp;
+			return true;
+		}
+	}
+	return false;
+}
+
+// bucket_delete removes one copy of fp from bucket i and returns true, or returns false if fp is not there
+static inline bool
+bucket_delete(cuckoo_filter *cf, int i, uint16_t fp)
+{
+	uint16_t *b = &cf->buf[i*CUCKOO_BUCKET_SIZE];
+	for (int j = 0; j < CUCKOO_BUCKET_SIZE; j++) {
+		if (b[j] == fp) {
+			b[j] = 0;
+			return true;
+		}
+	}
+	return false;
+}
+
+/* Initialize a cuckoo filter that can hold (at least) n elements.
+ * The number of buckets is rounded up to a power of 2, and the bucket array
+ * is aligned to a cache line so that no bucket straddles two cache lines.
+ */
+cuckoo_filter *
+cuckoo_init(int n)
+{
+	cuckoo_filter *cf = (cuckoo_filter *)malloc(sizeof(cuckoo_filter));
+	long need = ((long)n * 100 / CUCKOO_LOAD_PCT + CUCKOO_BUCKET_SIZE - 1) / CUCKOO_BUCKET_SIZE;
+	cf->nbuckets = 1;
+	while (cf->nbuckets < need) {
+		cf->nbuckets <<= 1;
+	}
+	size_t bytes = (size_t)cf->nbuckets * CUCKOO_BUCKET_SIZE * sizeof(uint16_t);
+	bytes = (bytes + 63) & ~(size_t)63;
+	if (posix_memalign((void **)&cf->buf, 64, bytes) != 0) {
+		printf("failed to alloc memory for cuckoo filter\n");
+		exit(1);
+	}
+	memset(cf->buf, 0, bytes);
+	cf->count = 0;
+	cf->victim_fp = 0;
+	cf->victim_bucket = 0;
+	return cf;
+}
+
+void
+cuckoo_free(cuckoo_filter *cf)
+{
+	free(cf->buf);
+	free(cf);
+}
+
+/* Add elm into the given cuckoo filter. If both candidate buckets are full, a
+ * randomly chosen fingerprint is evicted to its alternate bucket, repeatedly, for at
+ * most CUCKOO_MAX_KICKS times. The last homeless fingerprint is kept as the "victim"
+ * so that no element is ever lost. Returns false (and adds nothing) when the filter
+ * is already full, i.e. a victim exists.
+ * Adding the same element twice stores two copies of its fingerprint.
+ */
+bool
+cuckoo_add(cuckoo_filter *cf, long long elm)
+{
+	if (cf->victim_fp) {
+		return false;
+	}
+	uint16_t fp;
+	int i;
+	cuckoo_index(cf, elm, &fp, &i);
+	if (bucket_insert(cf, i, fp)) {
+		cf->count++;
+		return true;
+	}
+	i = alt_bucket(cf, i, fp);
+	if (bucket_insert(cf, i, fp)) {
+		cf->count++;
+		return true;
+	}
+	for (int n = 0; n < CUCKOO_MAX_KICKS; n++) {
+		// swap fp with a random resident of bucket i and move the resident to its other bucket
+		uint16_t *slot = &cf->buf[i*CUCKOO_BUCKET_SIZE + rand() % CUCKOO_BUCKET_SIZE];
+		uint16_t evicted = *slot;
+		*slot = fp;
+		fp = evicted;
+		i = alt_bucket(cf, i, fp);
+		if (bucket_insert(cf, i, fp)) {
+			cf->count++;
+			return true;
+		}
+	}
+	cf->victim_fp = fp;
+	cf->victim_bucket = i;
+	cf->count++;
+	return true;
+}
+
+/* Query if elm is in the given cuckoo filter (with high probability).
+ * Only the two candidate buckets of elm (and the victim slot) are examined.
+ */
+bool
+cuckoo_query(cuckoo_filter *cf, long long elm)
+{
+	uint16_t fp;
+	int i1;
+	cuckoo_index(cf, elm, &fp, &i1);
+	int i2 = alt_bucket(cf, i1, fp);
+	bool found = bucket_has(cf, i1, fp) | bucket_has(cf, i2, fp);
+	RK_STAT_ADD(filter_probes, 2);
+	if (cf->victim_fp == fp) {
+		found |= (cf->victim_bucket == i1 || cf->victim_bucket == i2);
+	}
+	return found;
+}
+
+/* Remove one copy of elm from the given cuckoo filter.
+ * Returns false if elm's fingerprint was not found. Only remove elements that
+ * were previously added; otherwise the fingerprint of a different element that
+ * happens to collide with elm may be removed instead.
+ */
+bool
+cuckoo_remove(cuckoo_filter *cf, long long elm)
+{
+	uint16_t fp;
+	int i1;
+	cuckoo_index(cf, elm, &fp, &i1);
+	int i2 = alt_bucket(cf, i1, fp);
+	if (cf->victim_fp == fp && (cf->victim_bucket == i1 || cf->victim_bucket == i2)) {
+		cf->victim_fp = 0;
+		cf->count--;
+		return true;
+	}
+	if (!bucket_delete(cf, i1, fp) && !bucket_delete(cf, i2, fp)) {
+		return false;
+	}
+	cf->count--;
+	// a slot has been freed up, try to give the victim a proper home
+	if (cf->victim_fp) {
+		uint16_t victim = cf->victim_fp;
+		int i = cf->victim_bucket;
+		if (bucket_insert(cf, i, victim) || bucket_insert(cf, alt_bucket(cf, i, victim), victim)) {
+			cf->victim_fp = 0;
+		}
+	}
+	return true;
+}
+
+/* cuckoo_size_in_bits returns the size of the fingerprint table in bits */
+long
+cuckoo_size_in_bits(cuckoo_filter *cf)
+{
+	return (long)cf->nbuckets * CUCKOO_BUCKET_SIZE * 16;
+}
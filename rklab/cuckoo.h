@@ -0,0 +1,27 @@
+#ifndef __CUCKOO_H_
+#define __CUCKOO_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* number of fingerprint slots in one bucket */
+#define CUCKOO_BUCKET_SIZE 4
+
+typedef struct {
+	uint16_t *buf; /* nbuckets*CUCKOO_BUCKET_SIZE 16-bit fingerprints, 0 marks an empty slot */
+	int nbuckets; /* number of buckets, always a power of 2 */
+	int count; /* number of stored fingerprints (including the victim) */
+	uint16_t victim_fp; /* fingerprint that could not be placed after CUCKOO_MAX_KICKS relocations */
+	int victim_bucket;
+} cuckoo_filter;
+
+cuckoo_filter *cuckoo_init(int n);
+void cuckoo_free(cuckoo_filter *cf);
+
+bool cuckoo_add(cuckoo_filter *cf, long long elm);
+bool cuckoo_query(cuckoo_filter *cf, long long elm);
+bool cuckoo_remove(cuckoo_filter *cf, long long elm);
+
+long cuckoo_size_in_bits(cuckoo_filter *cf);
+
+#endif
@@ -0,0 +1,303 @@
+/***********************************************************
+ File Name: rkglob.c
+ Description: wildcard patterns with a literal-fragment prefilter
+ **********************************************************/
+
+#define _GNU_SOURCE /* for memmem */
+#include <assert.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "rkpatterns.h"
+#include "rkglob.h"
+
+/* A glob like "ERROR*timeout" can only match a line that contains all of its literal
+ * fragments ("ERROR" and "timeout"). We put the longest fragment of every glob (its
+ * "anchor") into one rk_patterns set, and find all occurrences of all anchors with a
+ * single multi-pattern RK scan. Only the lines containing an anchor are candidates:
+ * for those we check that the other fragments are present too, and then run the full
+ * glob matcher on the line. A selective glob thus costs about as much as searching
+ * for its anchor as a literal.
+ * Matching is line by line: a glob matches a line if it matches some substring of
+ * the line. The reported match is the leftmost-longest one.
+ */
+
+static void
+glob_init(rk_glob *g, const char *src)
+{
+	int n = strlen(src);
+	g->kind = (char *)malloc(n + 1);
+	g->lit = (char *)malloc(n + 1);
+	g->frags = (char **)malloc(sizeof(char *)*(n + 1));
+	assert(g->kind && g->lit && g->frags);
+	g->ntok = 0;
+	for (int i = 0; i < n; i++) {
+		int k = g->ntok++;
+		if (src[i] == '*') {
+			g->kind[k] = GlobStar;
+		} else if (src[i] == '?') {
+			g->kind[k] = GlobAny;
+		} else {
+			if (src[i] == '\\' && i + 1 < n) {
+				i++;
+			}
+			g->kind[k] = GlobLit;
+			g->lit[k] = src[i];
+		}
+	}
+
+	// split the literal tokens into fragments, and pick the longest one as the anchor
+	g->n_frags = 0;
+	g->anchor = -1;
+	int best = 0;
+	for (int k = 0; k < g->ntok; ) {
+		if (g->kind[k] != GlobLit) {
+			k++;
+			continue;
+		}
+		int start = k;
+		while (k < g->ntok && g->kind[k] == GlobLit) {
+			k++;
+		}
+		char *f = (char *)malloc(k - start + 1);
+		memcpy(f, g->lit + start, k - start);
+		f[k - start] = '\0';
+		if (k - start > best) {
+			best = k - start;
+			g->anchor = g->n_frags;
+		}
+		g->frags[g->n_frags++] = f;
+	}
+}
+
+/* rk_glob_compile compiles n_globs glob patterns. The anchor fragments are compiled
+ * into an rk_patterns set with the given rk_patterns_compile flags.
+ */
+rk_globset *
+rk_glob_compile(char **globs, int n_globs, int flags)
+{
+	rk_globset *gs = (rk_globset *)malloc(sizeof(rk_globset));
+	gs->n_globs = n_globs;
+	gs->globs = (rk_glob *)malloc(sizeof(rk_glob)*n_globs);
+	gs->anchor_glob = (int *)malloc(sizeof(int)*n_globs);
+	char **anchors = (char **)malloc(sizeof(char *)*n_globs);
+	assert(gs->globs && gs->anchor_glob && anchors);
+	int n_anchors = 0;
+	for (int i = 0; i < n_globs; i++) {
+		rk_glob *g = &gs->globs[i];
+		glob_init(g, globs[i]);
+		if (g->anchor >= 0) {
+			gs->anchor_glob[n_anchors] = i;
+			anchors[n_anchors++] = g->frags[g->anchor];
+		}
+	}
+	gs->anchors = n_anchors > 0 ? rk_patterns_compile(anchors, n_anchors, flags) : NULL;
+	free(anchors);
+	return gs;
+}
+
+void
+rk_glob_free(rk_globset *gs)
+{
+	for (int i = 0; i < gs->n_globs; i++) {
+		rk_glob *g = &gs->globs[i];
+		for (int j = 0; j < g->n_frags; j++) {
+			free(g->frags[j]);
+		}
+		free(g->frags);
+		free(g->kind);
+		free(g->lit);
+	}
+	if (gs->anchors) {
+		rk_patterns_free(gs->anchors);
+	}
+	free(gs->anchor_glob);
+	free(gs->globs);
+	free(gs);
+}
+
+// add_state adds token k (and, through '*' which may match nothing, the tokens after it)
+// to the state set
+static inline void
+add_state(const rk_glob *g, char *set, int k)
+{
+	while (!set[k]) {
+		set[k] = 1;
+		if (k == g->ntok || g->kind[k] != GlobStar) {
+			return;
+		}
+		k++;
+	}
+}
+
+// match_at simulates the glob (as an NFA over its tokens) on doc[s..le) and returns the
+// end of the longest match starting at s, or -1 if there is none
+static int
+match_at(const rk_glob *g, const char *doc, int s, int le, char *cur, char *nxt)
+{
+	int best = -1;
+	memset(cur, 0, g->ntok + 1);
+	add_state(g, cur, 0);
+	for (int i = s; ; i++) {
+		if (cur[g->ntok]) {
+			best = i;
+		}
+		if (i == le) {
+			break;
+		}
+		int alive = 0;
+		memset(nxt, 0, g->ntok + 1);
+		for (int k = 0; k < g->ntok; k++) {
+			if (!cur[k]) {
+				continue;
+			}
+			if (g->kind[k] == GlobStar) {
+				add_state(g, nxt, k);
+				alive = 1;
+			} else if (g->kind[k] == GlobAny || g->lit[k] == doc[i]) {
+				add_state(g, nxt, k + 1);
+				alive = 1;
+			}
+		}
+		if (!alive) {
+			break;
+		}
+		char *t = cur;
+		cur = nxt;
+		nxt = t;
+	}
+	return best;
+}
+
+// match_line runs the glob on the line doc[ls..le). It returns the start of the
+// leftmost match and stores its length in *mlen, or returns -1 if the line does not match
+static int
+match_line(const rk_glob *g, const char *doc, int ls, int le, int *mlen, char *cur, char *nxt)
+{
+	for (int j = 0; j < g->n_frags; j++) {
+		if (j != g->anchor && !memmem(doc + ls, le - ls, g->frags[j], strlen(g->frags[j]))) {
+			return -1;
+		}
+	}
+	for (int s = ls; s <= le; s++) {
+		if (g->ntok > 0 && g->kind[0] == GlobLit && (s == le || doc[s] != g->lit[0])) {
+			continue;
+		}
+		int e = match_at(g, doc, s, le, cur, nxt);
+		if (e >= 0) {
+			*mlen = e - s;
+			return s;
+		}
+	}
+	return -1;
+}
+
+typedef struct {
+	int glob;
+	int pos;
+} candidate;
+
+typedef struct {
+	const rk_globset *gs;
+	candidate *c;
+	int n;
+	int cap;
+} candidates;
+
+static void
+add_candidate(void *arg, int i, int pos)
+{
+	candidates *l = (candidates *)arg;
+	if (l->n == l->cap) {
+		l->cap = l->cap ? 2*l->cap : 1024;
+		l->c = (candidate *)realloc(l->c, sizeof(candidate)*l->cap);
+		assert(l->c);
+	}
+	l->c[l->n].glob = l->gs->anchor_glob[i];
+	l->c[l->n].pos = pos;
+	l->n++;
+}
+
+static int
+cmp_candidate(const void *a, const void *b)
+{
+	const candidate *x = (const candidate *)a, *y = (const candidate *)b;
+	if (x->glob != y->glob) {
+		return x->glob - y->glob;
+	}
+	return x->pos - y->pos;
+}
+
+/* rk_glob_scan finds the globs of gs in the null-terminated document doc.
+ * For each glob i, it stores the number of matching lines in n_matches[i], and the
+ * position and length of the leftmost-longest match in the first matching line in
+ * first_match_ind[i] (-1 if no line matches) and first_match_len[i].
+ * It returns the total number of matching lines.
+ */
+int
+rk_glob_scan(const rk_globset *gs, const char *doc, int *n_matches, int *first_match_ind, int *first_match_len)
+{
+	int len = strlen(doc);
+	int max_tok = 0;
+	for (int i = 0; i < gs->n_globs; i++) {
+		n_matches[i] = 0;
+		first_match_ind[i] = -1;
+		first_match_len[i] = 0;
+		if (gs->globs[i].ntok > max_tok) {
+			max_tok = gs->globs[i].ntok;
+		}
+	}
+	char *cur = (char *)malloc(max_tok + 1);
+	char *nxt = (char *)malloc(max_tok + 1);
+
+	// find where the anchors occur, and order the candidates by glob and position
+	candidates l = {gs, NULL, 0, 0};
+	if (gs->anchors) {
+		rk_patterns_foreach(gs->anchors, doc, len, 0, len, add_candidate, &l);
+		qsort(l.c, l.n, sizeof(candidate), cmp_candidate);
+	}
+
+	int total = 0;
+	int c = 0;
+	for (int i = 0; i < gs->n_globs; i++) {
+		const rk_glob *g = &gs->globs[i];
+		int le = -1; // end of the last line that has been checked
+		for (int pos = 0; ; ) {
+			if (g->anchor >= 0) {
+				// the next candidate line (not yet checked) of this glob
+				while (c < l.n && l.c[c].glob == i && l.c[c].pos <= le) {
+					c++;
+				}
+				if (c == l.n || l.c[c].glob != i) {
+					break;
+				}
+				pos = l.c[c].pos;
+			} else if (le + 1 >= len) {
+				break;
+			} else {
+				// without any literal fragment, every line is a candidate
+				pos = le + 1;
+			}
+			int ls = pos;
+			while (ls > 0 && doc[ls-1] != '\n') {
+				ls--;
+			}
+			const char *nl = memchr(doc + pos, '\n', len - pos);
+			le = nl ? nl - doc : len;
+			int mlen;
+			int s = match_line(g, doc, ls, le, &mlen, cur, nxt);
+			if (s >= 0) {
+				if (n_matches[i]++ == 0) {
+					first_match_ind[i] = s;
+					first_match_len[i] = mlen;
+				}
+				total++;
+			}
+		}
+	}
+	free(l.c);
+	free(cur);
+	free(nxt);
+	return total;
+}
@@ -0,0 +1,33 @@
+#ifndef __RKGLOB_H_
+#define __RKGLOB_H_
+
+#include "rkpatterns.h"
+
+/* kinds of glob tokens */
+enum glob_tok {GlobLit, GlobAny, GlobStar};
+
+/* A compiled glob pattern: '?' matches any single character, '*' matches any run of
+ * characters (both only within a line), '\' escapes the next character, and all other
+ * characters match themselves.
+ */
+typedef struct {
+	int ntok; /* number of tokens */
+	char *kind; /* kind[k] is the enum glob_tok of token k */
+	char *lit; /* lit[k] is the character matched by a GlobLit token k */
+	int n_frags; /* number of literal fragments, i.e. maximal runs of GlobLit tokens */
+	char **frags; /* the literal fragments (null-terminated) */
+	int anchor; /* the longest fragment, used to find candidate lines (-1 if no fragment) */
+} rk_glob;
+
+typedef struct {
+	int n_globs;
+	rk_glob *globs;
+	rk_patterns *anchors; /* the anchor fragments of all globs that have one */
+	int *anchor_glob; /* anchor_glob[i] is the glob whose anchor is the i-th pattern of anchors */
+} rk_globset;
+
+rk_globset *rk_glob_compile(char **globs, int n_globs, int flags);
+int rk_glob_scan(const rk_globset *gs, const char *doc, int *n_matches, int *first_match_ind, int *first_match_len);
+void rk_glob_free(rk_globset *gs);
+
+#endif
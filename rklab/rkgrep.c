@@ -15,8 +15,11 @@
 
 #include "rkgrep.h"
 #include "bloom.h"
+#include "cuckoo.h"
+#include "rkstats.h"
 
 #define PRIME 961748941
+#define PRIME2 1000000007
 
 // calculate modulo addition, i.e. (a+b) % PRIME
 long long
@@ -39,6 +42,41 @@ mmul(long long a, long long b)
 	return (a*b) % PRIME;
 }
 
+/* rkhash2_init and rkhash2_next compute a "dual" RK hash: two independent RK hashes,
+ * modulo PRIME and modulo PRIME2, packed into one long long (the hash modulo PRIME
+ * in the upper 32 bits, the one modulo PRIME2 in the lower 32 bits).
+ * Two different substrings collide only if they collide under both moduli, so with
+ * ~2^60 possible values spurious hash matches (which must be rejected by comparing
+ * the substring byte-by-byte) become negligible, even on very large documents.
+ * Just like rkhash_init, rkhash2_init stores 256^m (for both moduli, packed) in *h,
+ * to be passed to rkhash2_next.
+ */
+long long
+rkhash2_init(const char *charbuf, int m, long long *h)
+{
+	long long x1 = 0, x2 = 0, h1 = 1, h2 = 1;
+	for (int i = 0; i < m; i++) {
+		unsigned char c = charbuf[i];
+		x1 = (x1 * 256 + c) % PRIME;
+		x2 = (x2 * 256 + c) % PRIME2;
+		h1 = (h1 * 256) % PRIME;
+		h2 = (h2 * 256) % PRIME2;
+	}
+	*h = (h1 << 32) | h2;
+	return (x1 << 32) | x2;
+}
+
+long long
+rkhash2_next(long long curr_hash, long long h, char leftmost, char rightmost)
+{
+	unsigned char l = leftmost, r = rightmost;
+	long long x1 = curr_hash >> 32, x2 = curr_hash & 0xffffffff;
+	long long h1 = h >> 32, h2 = h & 0xffffffff;
+	x1 = (x1 * 256 + PRIME - (h1 * l) % PRIME + r) % PRIME;
+	x2 = (x2 * 256 + PRIME2 - (h2 * l) % PRIME2 + r) % PRIME2;
+	return (x1 << 32) | x2;
+}
+
 /* naive_substring_match returns number of positions in the document where
  * the pattern has been found.  In addition, it stores the first position 
  * where the pattern is found in the variable pointed to by first_match_ind
@@ -120,3 +158,34 @@ rk_substring_match_using_bloom(const char *pattern, const char *doc, bloom_filte
     /* Your code here */
     return 0;
 }
+
+/* rk_create_doc_cuckoo returns a pointer to a newly created cuckoo_filter populated
+ * with the rabin-karp hashes of all substrings of length m in "doc". It can be used in
+ * place of the bloom filter created by rk_create_doc_bloom: look up a pattern's RK hash
+ * with cuckoo_query() before running rk_substring_match().
+ * A document usually repeats many of its substrings, and a cuckoo filter can only hold
+ * a few copies of the same fingerprint, so hashes that are already present are skipped.
+ */
+cuckoo_filter *
+rk_create_doc_cuckoo(int m, const char *doc)
+{
+	int n = strlen(doc);
+	cuckoo_filter *cf = cuckoo_init(n >= m ? n-m+1 : 1);
+	if (n < m) {
+		return cf;
+	}
+	long long h;
+	long long hash = rkhash_init(doc, m, &h);
+	for (int i = 0; ; i++) {
+		if (!cuckoo_query(cf, hash)) {
+			cuckoo_add(cf, hash);
+		}
+		if (i + m >= n) {
+			break;
+		}
+		hash = rkhash_next(hash, h, doc[i], doc[i+m]);
+	}
+	RK_STAT_ADD(bytes_scanned, n);
+	RK_STAT_ADD(windows_hashed, n-m+1);
+	return cf;
+}
@@ -17,12 +17,23 @@
 #include <time.h>
 #include <ctype.h>
 #include <string.h>
+#include <math.h>
 
 #include "bloom.h"
 #include "rkgrep.h"
+#include "rkpatterns.h"
+#include "rkglob.h"
+#include "rkscan.h"
+#include "rksketch.h"
+#include "rkminhash.h"
+#include "rkpipe.h"
+#include "rkstats.h"
 
 #define MAX_PATTERNS 1000
 
+/* at most this many characters before and after a match are printed for a file that is not in memory */
+#define MAX_LINE_CONTEXT 4096
+
 #define NORMALCOLOR "\x1B[0m"
 #define REDCOLOR "\x1B[31m"
 
@@ -74,7 +85,7 @@ read_ascii_file(const char *fname)
 		}
 	}
 	close(fd);
-	if (!doc) {
+	if (doc) {
 		doc[st.st_size] = '\0';
 	}
 	return doc;
@@ -110,17 +121,110 @@ print_matched_sentence(int pos, char *pattern, char *doc)
 	printf("\n");
 }
 
+/* like print_matched_sentence, for a match at offset pos of the file fname, which
+	 is read again (at most MAX_LINE_CONTEXT characters on either side of the match) */
+void
+print_matched_sentence_in_file(long long pos, char *pattern, const char *fname)
+{
+	if (pos < 0) {
+		return;
+	}
+	FILE *f = fopen(fname, "r");
+	if (!f) {
+		perror("print_matched_sentence_in_file: fopen ");
+		return;
+	}
+	long long start = pos > MAX_LINE_CONTEXT ? pos - MAX_LINE_CONTEXT : 0;
+	char buf[2*MAX_LINE_CONTEXT + 1];
+	fseeko(f, start, SEEK_SET);
+	int n = fread(buf, 1, 2*MAX_LINE_CONTEXT, f);
+	buf[n] = '\0';
+	fclose(f);
+	print_matched_sentence(pos - start, pattern, buf);
+}
+
+/* like print_matched_sentence, but highlights the len characters at pos
+	 (used for glob matches, which are not equal to the pattern) */
+void
+print_matched_span(int pos, int len, char *doc)
+{
+	if (pos < 0) {
+		return;
+	}
+	int start_sentence = pos;
+	while (start_sentence > 0 && doc[start_sentence-1] != '\n') {
+		start_sentence--;
+	}
+	printf("%.*s%s%.*s%s", pos - start_sentence, doc + start_sentence, REDCOLOR, len, doc + pos, NORMALCOLOR);
+	int end = pos + len;
+	while (doc[end] != '\n' && doc[end] != '\0') {
+		end++;
+	}
+	printf("%.*s\n", end - pos - len, doc + pos + len);
+}
+
+/* print the heavy hitters of the sketch, one per line, with newlines in the snippets escaped */
+void
+print_top_k(const rk_sketch *sk)
+{
+	printf("-- %d most frequent %d-grams of %ld, counts are at most %ld too high (with probability %.0f%%)\n",
+	       sk->n_top, sk->m, sk->n, rk_sketch_error(sk), 100*(1 - exp(-CMS_DEPTH)));
+	for (int i = 0; i < sk->n_top; i++) {
+		printf("%8ld  ", sk->top[i].count);
+		for (int j = 0; j < sk->m; j++) {
+			char c = sk->top[i].gram[j];
+			if (c == '\n') {
+				printf("\\n");
+			} else {
+				printf("%c", c);
+			}
+		}
+		printf("\n");
+	}
+}
+
+/* print how rkgrep is used. -d only changes the hashes of the compiled patterns, which
+	 -a naive, rk and rkbloom do not use */
+void
+usage()
+{
+	printf("rkgrep -a naive|rk|rkbloom [-f bloom|cuckoo] [-S] pattern1|pattern2|pattern3 <filename>\n");
+	printf("rkgrep -a glob [-d] [-S] pattern1|pattern2|pattern3 <filename>\n");
+	printf("rkgrep -a rkset [-j <threads>] [-D] [-d] [-S] pattern1|pattern2|pattern3 <filename>\n");
+	printf("rkgrep -c|-q [-j <threads>] [-D] [-d] [-S] pattern1|pattern2|pattern3 <filename>\n");
+	printf("rkgrep -r <directory> [-j <threads>] [-d] [-S] pattern1|pattern2|pattern3\n");
+	printf("rkgrep --top-k <N> -m <len> [-d] [-S] <filename>\n");
+	printf("rkgrep --near-dup -m <len> [-t <threshold>] [-d] [-S] <filename1> <filename2> ...\n");
+}
+
 int 
 main(int argc, char **argv)
 {
 	enum algo_type which_algo = RK; /* default match algorithm is simple */
+	enum algo_type which_filter = Bloom; /* document filter used by the rkbloom algorithm */
+	char *scan_dir = NULL; /* search all files under this directory */
+	int n_threads = sysconf(_SC_NPROCESSORS_ONLN); /* number of threads used to search a directory */
+	int rk_flags = 0; /* flags for compiling the patterns of the rkset algorithm and -r */
+	int pipe_flags = 0; /* flags for reading the file of the rkset algorithm */
+	int count_only = 0; /* only print the number of matches */
+	int exists_only = 0; /* print nothing, the exit status tells whether some pattern occurs */
+	int show_stats = 0; /* print hot-path statistics to stderr */
+	int top_k = 0; /* if not 0, report the top_k most frequent snippets instead of searching */
+	int snippet_len = 0; /* length of the snippets counted for --top-k (and shingles for --near-dup) */
+	int near_dup = 0; /* report pairs of similar files instead of searching */
+	double threshold = 0.8; /* similarity above which --near-dup reports a pair */
+	struct option long_options[] = {
+		{"top-k", required_argument, NULL, 'k'},
+		{"near-dup", no_argument, NULL, 'N'},
+		{NULL, 0, NULL, 0}
+	};
 	
 	/* Refuse to run on platform with a different size for long long*/
 	assert(sizeof(long long) == 8);
 
 	/*getopt is a C library function to parse command line options */
 	int c;
-	while ((c = getopt(argc, argv, "a:")) != -1) {
+	while ((c = getopt_long(argc, argv, "a:f:r:j:dSk:m:t:Dcq", long_options, NULL)) != -1) {
 	       	switch (c) {
 			case 'a':
 				if (strcmp(optarg, "naive") == 0) {
@@ -129,13 +233,60 @@ main(int argc, char **argv)
 					which_algo = RK;
 				} else if (strcmp(optarg, "rkbloom") == 0) {
 					which_algo = RKBloom;
+				} else if (strcmp(optarg, "rkset") == 0) {
+					which_algo = RKSet;
+				} else if (strcmp(optarg, "glob") == 0) {
+					which_algo = Glob;
 				} else {
 					printf("unknown test type %s", optarg);
 				       	exit(1);
 				}
 				break;
+			case 'f':
+				if (strcmp(optarg, "bloom") == 0) {
+					which_filter = Bloom;
+				} else if (strcmp(optarg, "cuckoo") == 0) {
+					which_filter = Cuckoo;
+				} else {
+					printf("unknown filter type %s", optarg);
+				       	exit(1);
+				}
+				break;
+			case 'r':
+				scan_dir = optarg;
+				break;
+			case 'j':
+				n_threads = atoi(optarg);
+				break;
+			case 'd':
+				rk_flags |= RK_DUAL_HASH;
+				break;
+			case 'S':
+				show_stats = 1;
+				break;
+			case 'D':
+				pipe_flags |= PIPE_DIRECT;
+				break;
+			case 'c':
+				count_only = 1;
+				break;
+			case 'q':
+				exists_only = 1;
+				break;
+			case 'k':
+				top_k = atoi(optarg);
+				break;
+			case 'm':
+				snippet_len = atoi(optarg);
+				break;
+			case 'N':
+				near_dup = 1;
+				break;
+			case 't':
+				threshold = atof(optarg);
+				break;
 			default:
-				printf("rkgrep -a <test type> pattern1|pattern2|pattern3 <filename>\n");
+				usage();
 				exit(1);
 		}
        	}
@@ -144,10 +295,73 @@ main(int argc, char **argv)
 		 it now contains the index of the first argv-element 
 		 that is not an option*/
 	if (argc - optind < 1) {
-		printf("rkgrep -a <test type> pattern1|pattern2|pattern3 <filename>\n");
+		usage();
 		exit(1);
 	}
 
+	if (top_k) {
+		// count the snippets of the file in one pass, in memory independent of its size
+		if (top_k < 0 || snippet_len <= 0) {
+			printf("rkgrep --top-k <N> -m <len> <filename>\n");
+			exit(1);
+		}
+		// the file is read a chunk at a time, so the query phase includes reading it
+		RK_PHASE_START(t_query);
+		rk_sketch *sk = rk_sketch_init(top_k, snippet_len, CMS_WIDTH);
+		if (rk_topk_scan_file(sk, argv[optind], 0, rk_flags) < 0) {
+			exit(1);
+		}
+		rk_topk_sort(sk);
+		RK_PHASE_END(t_query, RK_PHASE_QUERY);
+		RK_PHASE_START(t_output);
+		print_top_k(sk);
+		RK_PHASE_END(t_output, RK_PHASE_OUTPUT);
+		rk_sketch_free(sk);
+		if (show_stats) {
+			fflush(stdout);
+			rk_stats_print(stderr, &rk_stat);
+		}
+		return 0;
+	}
+
+	if (near_dup) {
+		// one MinHash signature per file, then LSH to find the similar pairs
+		if (snippet_len <= 0) {
+			printf("rkgrep --near-dup -m <len> [-t <threshold>] <filename1> <filename2> ...\n");
+			exit(1);
+		}
+		int n_docs = argc - optind;
+		rk_minhash *sigs = (rk_minhash *)malloc(sizeof(rk_minhash)*n_docs);
+		for (int i = 0; i < n_docs; i++) {
+			RK_PHASE_START(t_load);
+			char *doc = read_ascii_file(argv[optind+i]);
+			if (!doc) {
+				exit(1);
+			}
+			RK_PHASE_END(t_load, RK_PHASE_LOAD);
+			RK_PHASE_START(t_index);
+			rk_minhash_doc(doc, snippet_len, rk_flags, &sigs[i]);
+			RK_PHASE_END(t_index, RK_PHASE_INDEX);
+			free(doc);
+		}
+		RK_PHASE_START(t_query);
+		rk_dup_pair *pairs;
+		int n_pairs = rk_lsh_pairs(sigs, n_docs, LSH_BANDS, threshold, &pairs);
+		RK_PHASE_END(t_query, RK_PHASE_QUERY);
+		RK_PHASE_START(t_output);
+		for (int i = 0; i < n_pairs; i++) {
+			printf("%.2f  %s  %s\n", pairs[i].sim, argv[optind+pairs[i].a], argv[optind+pairs[i].b]);
+		}
+		RK_PHASE_END(t_output, RK_PHASE_OUTPUT);
+		free(pairs);
+		free(sigs);
+		if (show_stats) {
+			fflush(stdout);
+			rk_stats_print(stderr, &rk_stat);
+		}
+		return 0;
+	}
+
 	char *patterns[MAX_PATTERNS];
 	char *ind = NULL;
 	char *ptr = strtok_r(argv[optind], "|", &ind);
@@ -158,34 +372,123 @@ main(int argc, char **argv)
 	       	ptr = strtok_r(NULL, "|", &ind);
 	}
 	if (!n_patterns) {
-		printf("rkgrep -a <test type> pattern1|pattern2|pattern3 <filename>\n");
+		usage();
 		exit(1);
 	}
 
+	if (scan_dir) {
+		if (count_only || exists_only) {
+			printf("-c and -q are not supported with -r\n");
+			exit(1);
+		}
+		if (which_algo == Glob) {
+			printf("-a glob is not supported with -r\n");
+			exit(1);
+		}
+		// search the whole directory tree with the compiled patterns
+		RK_PHASE_START(t_index);
+		rk_patterns *ps = rk_patterns_compile(patterns, n_patterns, rk_flags);
+		RK_PHASE_END(t_index, RK_PHASE_INDEX);
+		int files_matched = rk_scan_tree(scan_dir, ps, n_threads);
+		rk_patterns_free(ps);
+		if (show_stats) {
+			fprintf(stderr, "-- (times are summed over %d threads)\n", n_threads);
+			rk_stats_print(stderr, &rk_stat);
+		}
+		// like grep, a file or directory that could not be searched makes the exit status 2
+		return files_matched < 0 ? 2 : 0;
+	}
+
+	if (argc - optind < 2) {
+		usage();
+		exit(1);
+	}
+	if (count_only || exists_only) {
+		// the compiled patterns have kernels that only count, or stop at the first match
+		RK_PHASE_START(t_index);
+		rk_patterns *ps = rk_patterns_compile(patterns, n_patterns, rk_flags);
+		RK_PHASE_END(t_index, RK_PHASE_INDEX);
+		pipe_flags |= exists_only ? PIPE_EXISTS : PIPE_COUNT;
+		int total = rk_pipe_scan(argv[optind+1], ps, n_threads, 0, pipe_flags, NULL, NULL);
+		if (total < 0) {
+			exit(2);
+		}
+		if (!exists_only) {
+			printf("%d\n", total);
+		}
+		rk_patterns_free(ps);
+		if (show_stats) {
+			fflush(stdout);
+			rk_stats_print(stderr, &rk_stat);
+		}
+		// like grep, the exit status is 0 if some pattern was found, 1 if none was
+		return total > 0 ? 0 : 1;
+	}
+
+	if (which_algo == RKSet) {
+		// compile all patterns once and find them in a single pass per pattern length,
+		// matching each part of the file while the next parts are being read
+		RK_PHASE_START(t_index);
+		rk_patterns *ps = rk_patterns_compile(patterns, n_patterns, rk_flags);
+		RK_PHASE_END(t_index, RK_PHASE_INDEX);
+		int n_matches[MAX_PATTERNS];
+		long long first_match_off[MAX_PATTERNS];
+		if (rk_pipe_scan(argv[optind+1], ps, n_threads, 0, pipe_flags, n_matches, first_match_off) < 0) {
+			exit(1);
+		}
+		RK_PHASE_START(t_output);
+		for (int i = 0; i < n_patterns; i++) {
+			print_matched_sentence_in_file(first_match_off[i], patterns[i], argv[optind+1]);
+			if (n_matches[i] > 1) {
+			       	printf("--  only 1 out %d matches for pattern %s is displayed\n", n_matches[i], patterns[i]);
+		       	}
+		}
+		RK_PHASE_END(t_output, RK_PHASE_OUTPUT);
+		rk_patterns_free(ps);
+		if (show_stats) {
+			fflush(stdout);
+			fprintf(stderr, "-- (times are summed over %d threads and the reader)\n", n_threads);
+			rk_stats_print(stderr, &rk_stat);
+		}
+		return 0;
+	}
+
+	RK_PHASE_START(t_load);
 	char* doc = read_ascii_file(argv[optind+1]);
 	if (!doc) {
 		exit(1);
 	}
+	RK_PHASE_END(t_load, RK_PHASE_LOAD);
 	
 	switch (which_algo) {
             case Naive:
 		    for (int i = 0; i < n_patterns; i++) {
 			    int first_match_ind;
+			    RK_PHASE_START(t_query);
 			    int n_matches = naive_substring_match(patterns[i], doc, &first_match_ind);
+			    RK_STAT_ADD(bytes_scanned, strlen(doc));
+			    RK_PHASE_END(t_query, RK_PHASE_QUERY);
+			    RK_PHASE_START(t_output);
 			    print_matched_sentence(first_match_ind, patterns[i], doc);
 			    if (n_matches > 1) {
 				    printf("--  only 1 out %d matches for pattern %s is displayed\n", n_matches, patterns[i]);
 			    }
+			    RK_PHASE_END(t_output, RK_PHASE_OUTPUT);
 		    }
 		    break;
 	    case RK:
 		    for (int i = 0; i < n_patterns; i++) {
 			    int first_match_ind;
+			    RK_PHASE_START(t_query);
 			    int n_matches = rk_substring_match(patterns[i], doc, &first_match_ind);
+			    RK_STAT_ADD(bytes_scanned, strlen(doc));
+			    RK_PHASE_END(t_query, RK_PHASE_QUERY);
+			    RK_PHASE_START(t_output);
 			    print_matched_sentence(first_match_ind, patterns[i], doc);
 			    if (n_matches > 1) {
 				    printf("--  only 1 out %d matches for pattern %s is displayed\n", n_matches, patterns[i]);
 			    }
+			    RK_PHASE_END(t_output, RK_PHASE_OUTPUT);
 		    }
 	       	break;
 	    case RKBloom: 
@@ -194,21 +497,93 @@ main(int argc, char **argv)
 			for (int i = 1; i < n_patterns; i++) {
 				assert(m == strlen(patterns[i]));
 			}
-			bloom_filter *bf = rk_create_doc_bloom(m, doc, strlen(doc)*8);
+			RK_PHASE_START(t_index);
+			long long hashes[MAX_PATTERNS];
+			bool maybe[MAX_PATTERNS];
+			for (int i = 0; i < n_patterns; i++) {
+				long long h;
+				hashes[i] = rkhash_init(patterns[i], m, &h);
+			}
+			bloom_filter *bf = NULL;
+			cuckoo_filter *cf = NULL;
+			if (which_filter == Cuckoo) {
+				cf = rk_create_doc_cuckoo(m, doc);
+			} else {
+				bf = rk_create_doc_bloom(m, doc, strlen(doc)*8);
+			}
+			RK_PHASE_END(t_index, RK_PHASE_INDEX);
+			RK_PHASE_START(t_filter);
+			if (cf) {
+				for (int i = 0; i < n_patterns; i++) {
+					maybe[i] = cuckoo_query(cf, hashes[i]);
+				}
+			} else {
+				// query the bloom filter for all patterns in one batch so that
+				// the cache misses of different patterns overlap
+				bloom_query_batch(bf, hashes, n_patterns, maybe);
+			}
+			RK_STAT_ADD(filter_queries, n_patterns);
+			RK_PHASE_END(t_filter, RK_PHASE_QUERY);
 			for (int i = 0; i < n_patterns; i++) {
+				if (!maybe[i]) {
+					continue;
+				}
 				int first_match_ind;
-				int n_matches = rk_substring_match_using_bloom(patterns[i], doc, bf, &first_match_ind);
-				print_matched_sentence(first_match_ind, patterns[i], doc);
+				RK_PHASE_START(t_query);
+				int n_matches = rk_substring_match(patterns[i], doc, &first_match_ind);
+				RK_STAT_ADD(bytes_scanned, strlen(doc));
+				RK_STAT_ADD(filter_positives, 1);
+				RK_STAT_ADD(filter_false_positives, n_matches == 0);
+				RK_PHASE_END(t_query, RK_PHASE_QUERY);
+				RK_PHASE_START(t_output);
+				if (n_matches > 0) {
+					print_matched_sentence(first_match_ind, patterns[i], doc);
+				}
 				if (n_matches > 1) {
 				       	printf("--  only 1 out %d matches for pattern %s is displayed\n", n_matches, patterns[i]);
 			       	}
+				RK_PHASE_END(t_output, RK_PHASE_OUTPUT);
+			}
+			if (bf) {
+				bloom_free(bf);
+			}
+			if (cf) {
+				cuckoo_free(cf);
 			}
 		}
 		break;
+	    case Glob:
+		{
+			// patterns are globs ('*', '?'); only lines containing the longest literal
+			// fragment of a glob are matched against it
+			RK_PHASE_START(t_index);
+			rk_globset *gs = rk_glob_compile(patterns, n_patterns, rk_flags);
+			RK_PHASE_END(t_index, RK_PHASE_INDEX);
+			int n_matches[MAX_PATTERNS];
+			int first_match_ind[MAX_PATTERNS];
+			int first_match_len[MAX_PATTERNS];
+			RK_PHASE_START(t_query);
+			rk_glob_scan(gs, doc, n_matches, first_match_ind, first_match_len);
+			RK_PHASE_END(t_query, RK_PHASE_QUERY);
+			RK_PHASE_START(t_output);
+			for (int i = 0; i < n_patterns; i++) {
+				print_matched_span(first_match_ind[i], first_match_len[i], doc);
+				if (n_matches[i] > 1) {
+				       	printf("--  only 1 out %d matching lines for pattern %s is displayed\n", n_matches[i], patterns[i]);
+			       	}
+			}
+			RK_PHASE_END(t_output, RK_PHASE_OUTPUT);
+			rk_glob_free(gs);
+		}
+		break;
 	    default :
 		printf("Unknown algo type %d\n", which_algo);
 	       	exit(1);
 	}
+	if (show_stats) {
+		fflush(stdout);
+		rk_stats_print(stderr, &rk_stat);
+	}
 	free(doc);
 	return 0;
 }
@@ -8,8 +8,17 @@
 #include <ctype.h>
 #include <time.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
 
 #include "rkgrep.h"
+#include "rkpatterns.h"
+#include "rkglob.h"
+#include "rksketch.h"
+#include "rkminhash.h"
+#include "rkpipe.h"
+#include "rkscan.h"
+#include "rkstats.h"
 #include "panic_cond.h"
 
 #define NUM_TESTS 5
@@ -231,6 +240,20 @@ test_bloom()
 		panic_cond(bloom_query(bf, test_numbers[i]), "Bloom filter should contain %lld\n", test_numbers[i]);
 	}
 
+	// batched queries must agree with one-at-a-time queries, for both members and (mostly) non-members
+	bool *found = (bool *)malloc(sizeof(bool)*2*n_inserted);
+	long long *queries = (long long *)malloc(sizeof(long long)*2*n_inserted);
+	for (int i = 0; i < 2*n_inserted; i++) {
+		queries[i] = (i < n_inserted) ? test_numbers[i] : ((long long)rand() << 31 | rand());
+	}
+	bloom_query_batch(bf, queries, 2*n_inserted, found);
+	for (int i = 0; i < 2*n_inserted; i++) {
+		panic_cond(found[i] == bloom_query(bf, queries[i]), "bloom_query_batch returns %d for %lld != %d (bloom_query)\n", found[i], queries[i], bloom_query(bf, queries[i]));
+	}
+	printf("bloom_query_batch agrees with bloom_query on %d queries\n", 2*n_inserted);
+	free(found);
+	free(queries);
+
 	for (int i = 0; i < test_bloom_bsz_large; i++) {
 		bool b = bloom_bit_at_pos(bf, i);
 	        bool b1 = bloom_bit_at_pos(bf1, i); 
@@ -289,6 +312,733 @@ test_rk_bloom()
 	printf("-- test_rk_bloom: OK --\n");
 }
 
+void
+test_cuckoo()
+{
+	printf("== test_cuckoo ===\n");
+	int n_inserted = test_document_len;
+	int n_queries = 10*n_inserted;
+	long long *test_numbers = (long long *)malloc(sizeof(long long)*n_inserted);
+	long long *queries = (long long *)malloc(sizeof(long long)*n_queries);
+	for (int i = 0; i < n_inserted; i++) {
+		test_numbers[i] = (long long)rand() << 31 | rand();
+	}
+	for (int i = 0; i < n_queries; i++) {
+		// random 62-bit numbers are (almost certainly) not among the inserted ones
+		queries[i] = ((long long)rand() << 31 | rand()) ^ (1LL << 62);
+	}
+
+	cuckoo_filter *cf = cuckoo_init(n_inserted);
+	for (int i = 0; i < n_inserted; i++) {
+		panic_cond(cuckoo_add(cf, test_numbers[i]), "Cuckoo filter is full after %d insertions\n", i);
+	}
+	for (int i = 0; i < n_inserted; i++) {
+		panic_cond(cuckoo_query(cf, test_numbers[i]), "Cuckoo filter should contain %lld\n", test_numbers[i]);
+	}
+	printf("inserted %d numbers into cuckoo filter of %d buckets\n", n_inserted, cf->nbuckets);
+
+	// the same workload against a bloom filter of (roughly) the same size, as rkgrep would use it
+	int bsz = (int)((cuckoo_size_in_bits(cf) + 7) / 8 * 8);
+	bloom_filter *bf = bloom_init(bsz);
+	for (int i = 0; i < n_inserted; i++) {
+		bloom_add(bf, test_numbers[i]);
+	}
+
+	struct timespec ts1, ts2;
+	int cuckoo_fp = 0, bloom_fp = 0;
+	clock_gettime(CLOCK_REALTIME, &ts1);
+	for (int i = 0; i < n_queries; i++) {
+		cuckoo_fp += cuckoo_query(cf, queries[i]);
+	}
+	clock_gettime(CLOCK_REALTIME, &ts2);
+	long long cuckoo_us = timediff(ts2, ts1);
+	clock_gettime(CLOCK_REALTIME, &ts1);
+	for (int i = 0; i < n_queries; i++) {
+		bloom_fp += bloom_query(bf, queries[i]);
+	}
+	clock_gettime(CLOCK_REALTIME, &ts2);
+	long long bloom_us = timediff(ts2, ts1);
+
+	printf("%-8s %12s %14s %14s\n", "filter", "bits/elem", "false-pos(%)", "ns/query");
+	printf("%-8s %12.2f %14.4f %14.2f\n", "cuckoo", (double)cuckoo_size_in_bits(cf)/n_inserted,
+	       100.0*cuckoo_fp/n_queries, 1000.0*cuckoo_us/n_queries);
+	printf("%-8s %12.2f %14.4f %14.2f\n", "bloom", (double)bsz/n_inserted,
+	       100.0*bloom_fp/n_queries, 1000.0*bloom_us/n_queries);
+	// expected false positive rate is 2*CUCKOO_BUCKET_SIZE/2^16 ~ 0.012%
+	panic_cond(cuckoo_fp <= n_queries/1000, "Cuckoo filter false positive rate %.4f%% is too high\n", 100.0*cuckoo_fp/n_queries);
+
+	// remove the first half, the second half must still be present
+	for (int i = 0; i < n_inserted/2; i++) {
+		panic_cond(cuckoo_remove(cf, test_numbers[i]), "Cuckoo filter failed to remove %lld\n", test_numbers[i]);
+	}
+	panic_cond(cf->count == n_inserted - n_inserted/2, "Cuckoo filter count is %d != %d (expected)\n", cf->count, n_inserted - n_inserted/2);
+	for (int i = n_inserted/2; i < n_inserted; i++) {
+		panic_cond(cuckoo_query(cf, test_numbers[i]), "Cuckoo filter should still contain %lld after removals\n", test_numbers[i]);
+	}
+	int still_found = 0;
+	for (int i = 0; i < n_inserted/2; i++) {
+		still_found += cuckoo_query(cf, test_numbers[i]);
+	}
+	panic_cond(still_found <= n_inserted/1000, "%d of %d removed numbers are still found\n", still_found, n_inserted/2);
+	printf("removed %d numbers from cuckoo filter\n", n_inserted/2);
+
+	bloom_free(bf);
+	cuckoo_free(cf);
+	free(test_numbers);
+	free(queries);
+	printf("-- test_cuckoo: OK --\n");
+}
+
+// count_occurrences returns the number of (possibly overlapping) positions where
+// pattern occurs in doc and stores the first one in *first (-1 if none)
+static int
+count_occurrences(const char *pattern, const char *doc, int *first)
+{
+	int n = 0;
+	*first = -1;
+	for (const char *p = strstr(doc, pattern); p; p = strstr(p + 1, pattern)) {
+		if (n++ == 0) {
+			*first = p - doc;
+		}
+	}
+	return n;
+}
+
+typedef struct {
+	char w[RK_WORD_MAX_LEN + 5];
+	long long hash;
+} hashed_word;
+
+static int
+cmp_hashed_word(const void *a, const void *b)
+{
+	long long x = ((const hashed_word *)a)->hash, y = ((const hashed_word *)b)->hash;
+	return (x > y) - (x < y);
+}
+
+void
+test_rk_patterns()
+{
+	printf("== test_rk_patterns ===\n");
+	int n_patterns = 200;
+	char *doc = generate_random_document(test_document_len);
+	char **patterns = (char **)malloc(sizeof(char *)*n_patterns);
+	for (int i = 0; i < n_patterns; i++) {
+		int len = 1 + rand() % 20;
+		patterns[i] = (char *)malloc(len + 1);
+		if (i % 2) {
+			// taken from the document, so it occurs at least once (some at the very
+			// end, where windows cannot be loaded 16 bytes at a time)
+			int pos = (i < 40) ? test_document_len - len : rand() % (test_document_len - len);
+			memcpy(patterns[i], doc + pos, len);
+			patterns[i][len] = '\0';
+		} else {
+			generate_random_word(patterns[i], len);
+		}
+	}
+	// a group with few distinct first/last bytes goes through the SIMD prefilter
+	char *few[] = {"abc", "aac", "zzzzzz", "zyxwvz", "e"};
+
+	int *n_matches = (int *)malloc(sizeof(int)*n_patterns);
+	int *first_match_ind = (int *)malloc(sizeof(int)*n_patterns);
+	int round_flags[] = {0, RK_DUAL_HASH, RK_NO_WORDS};
+	for (int round = 0; round < 6; round++) {
+		char **pats = (round & 1) ? few : patterns;
+		int n = (round & 1) ? 5 : n_patterns;
+		int flags = round_flags[round/2];
+		rk_patterns *ps = rk_patterns_compile(pats, n, flags);
+		struct timespec ts1, ts2;
+		clock_gettime(CLOCK_REALTIME, &ts1);
+		int total = rk_patterns_scan(ps, doc, n_matches, first_match_ind);
+		clock_gettime(CLOCK_REALTIME, &ts2);
+		int expected_total = 0;
+		for (int i = 0; i < n; i++) {
+			int first;
+			int expected = count_occurrences(pats[i], doc, &first);
+			panic_cond(n_matches[i] == expected, "Pattern (%s) has %d matches != %d (expected)\n", pats[i], n_matches[i], expected);
+			panic_cond(first_match_ind[i] == first, "Pattern (%s) first found at %d != %d (expected)\n", pats[i], first_match_ind[i], first);
+			expected_total += expected;
+		}
+		panic_cond(total == expected_total, "rk_patterns_scan returns %d != %d (expected)\n", total, expected_total);
+		int count = rk_patterns_count_range(ps, doc, test_document_len, 0, test_document_len);
+		panic_cond(count == expected_total, "rk_patterns_count_range returns %d != %d (expected)\n", count, expected_total);
+		int exists = rk_patterns_exists_range(ps, doc, test_document_len, 0, test_document_len);
+		panic_cond(exists == (expected_total > 0), "rk_patterns_exists_range returns %d != %d (expected)\n", exists, expected_total > 0);
+		printf("scanned %d patterns (%d length groups, %s hash%s) in %lld microseconds, %d matches\n", n, ps->n_groups,
+		       (flags & RK_DUAL_HASH) ? "dual" : "single", (flags & RK_NO_WORDS) ? "" : ", short ones as words",
+		       timediff(ts2, ts1), total);
+		rk_patterns_free(ps);
+	}
+
+	for (int i = 0; i < n_patterns; i++) {
+		free(patterns[i]);
+	}
+	free(patterns);
+	free(doc);
+
+	// find two different words whose single RK hashes collide (by the birthday paradox,
+	// 100000 random words give a few collisions with a ~2^30 modulus). They are longer
+	// than RK_WORD_MAX_LEN, as shorter patterns are compared without hashing
+	int n_words = 100000, word_len = RK_WORD_MAX_LEN + 4;
+	hashed_word *words = (hashed_word *)malloc(sizeof(hashed_word)*n_words);
+	for (int i = 0; i < n_words; i++) {
+		long long h;
+		generate_random_word(words[i].w, word_len);
+		words[i].hash = rkhash_init(words[i].w, word_len, &h);
+	}
+	qsort(words, n_words, sizeof(hashed_word), cmp_hashed_word);
+	int a = -1;
+	for (int i = 0; i + 1 < n_words && a < 0; i++) {
+		if (words[i].hash == words[i+1].hash && strcmp(words[i].w, words[i+1].w) != 0) {
+			a = i;
+		}
+	}
+	if (a >= 0) {
+		// the document is one word, the patterns are the colliding word plus fillers
+		// with distinct first letters (so that the rolling hash path is taken) that
+		// end like the document
+		char fillers[5][RK_WORD_MAX_LEN + 5];
+		char *pats[6] = {words[a+1].w};
+		for (int k = 0; k < 5; k++) {
+			generate_random_word(fillers[k], word_len);
+			fillers[k][0] = 'v' + k;
+			fillers[k][word_len-1] = words[a].w[word_len-1];
+			pats[k+1] = fillers[k];
+		}
+		for (int dual = 0; dual < 2; dual++) {
+			rk_patterns *ps = rk_patterns_compile(pats, 6, dual ? RK_DUAL_HASH : 0);
+			long false_hits = rk_stat.false_hits;
+			int total = rk_patterns_scan(ps, words[a].w, n_matches, first_match_ind);
+			false_hits = rk_stat.false_hits - false_hits;
+			panic_cond(total == 0, "Pattern (%s) should not have been found in doc (%s)\n", words[a+1].w, words[a].w);
+#ifndef RK_NO_STATS
+			// the counters are compiled out with -DRK_NO_STATS
+			if (dual) {
+				panic_cond(false_hits == 0, "dual hash of %s and %s should not collide\n", words[a+1].w, words[a].w);
+			} else {
+				panic_cond(false_hits == 1, "%ld false hits for colliding %s and %s != 1 (expected)\n", false_hits, words[a+1].w, words[a].w);
+			}
+#endif
+			rk_patterns_free(ps);
+		}
+		printf("%s and %s: single hashes collide, dual hashes do not\n", words[a].w, words[a+1].w);
+	}
+	free(words);
+	free(n_matches);
+	free(first_match_ind);
+	printf("-- test_rk_patterns: OK --\n");
+}
+
+// glob_match_ref reports whether the glob g matches all of str[0..n)
+static int
+glob_match_ref(const char *g, const char *str, int n)
+{
+	if (*g == '\0') {
+		return n == 0;
+	}
+	if (*g == '*') {
+		for (int k = 0; k <= n; k++) {
+			if (glob_match_ref(g + 1, str + k, n - k)) {
+				return 1;
+			}
+		}
+		return 0;
+	}
+	if (n == 0) {
+		return 0;
+	}
+	if (*g == '?') {
+		return glob_match_ref(g + 1, str + 1, n - 1);
+	}
+	if (*g == '\\' && g[1] != '\0') {
+		g++;
+	}
+	return *g == *str && glob_match_ref(g + 1, str + 1, n - 1);
+}
+
+// glob_scan_ref tries every substring of every line of doc, and returns the
+// number of lines that the glob matches, and the leftmost-longest match in the first one
+static int
+glob_scan_ref(const char *g, const char *doc, int *first, int *first_len)
+{
+	int n = 0;
+	*first = -1;
+	*first_len = 0;
+	for (int ls = 0; doc[ls] != '\0'; ) {
+		int le = ls;
+		while (doc[le] != '\n' && doc[le] != '\0') {
+			le++;
+		}
+		int found = 0;
+		for (int s = ls; s <= le && !found; s++) {
+			for (int e = le; e >= s && !found; e--) {
+				if (glob_match_ref(g, doc + s, e - s)) {
+					found = 1;
+					if (n == 0) {
+						*first = s;
+						*first_len = e - s;
+					}
+				}
+			}
+		}
+		n += found;
+		if (doc[le] == '\0') {
+			break;
+		}
+		ls = le + 1;
+	}
+	return n;
+}
+
+void
+test_glob()
+{
+	printf("== test_glob ===\n");
+	// the reference matcher tries all substrings of all lines, so keep the document
+	// small and break it into lines of about 40 characters
+	int doc_len = 5000;
+	char *doc = generate_random_document(doc_len);
+	for (int i = 0; i < doc_len; i++) {
+		if (rand() % 40 == 0) {
+			doc[i] = '\n';
+		}
+	}
+	doc[100] = '*';
+	doc[101] = '?';
+
+	int n_globs = 100;
+	char **globs = (char **)malloc(sizeof(char *)*n_globs);
+	char *fixed[] = {"\\*\\?", "?\\?", "??", "*", "a*b*c", "q?u"};
+	int n_fixed = sizeof(fixed)/sizeof(fixed[0]);
+	for (int i = 0; i < n_globs; i++) {
+		globs[i] = (char *)malloc(32);
+		if (i < n_fixed) {
+			strcpy(globs[i], fixed[i]);
+			continue;
+		}
+		// a substring of the document (mostly within a line) with some of its
+		// characters turned into '?', and one run of characters turned into '*'
+		int len = 3 + rand() % 12;
+		int pos = rand() % (doc_len - len);
+		int k = 0;
+		int star = rand() % len, star_len = rand() % 6;
+		for (int j = 0; j < len; j++) {
+			if (j == star) {
+				globs[i][k++] = '*';
+				j += star_len;
+			} else if (rand() % 6 == 0) {
+				globs[i][k++] = '?';
+			} else if (doc[pos + j] == '*' || doc[pos + j] == '?') {
+				continue;
+			} else {
+				globs[i][k++] = (i % 5) ? doc[pos + j] : 'a' + rand() % 26;
+			}
+		}
+		globs[i][k] = '\0';
+	}
+
+	int *n_matches = (int *)malloc(sizeof(int)*n_globs);
+	int *first_match_ind = (int *)malloc(sizeof(int)*n_globs);
+	int *first_match_len = (int *)malloc(sizeof(int)*n_globs);
+	rk_globset *gs = rk_glob_compile(globs, n_globs, 0);
+	int total = rk_glob_scan(gs, doc, n_matches, first_match_ind, first_match_len);
+	int expected_total = 0;
+	for (int i = 0; i < n_globs; i++) {
+		int first, first_len;
+		int expected = glob_scan_ref(globs[i], doc, &first, &first_len);
+		panic_cond(n_matches[i] == expected, "Glob (%s) matches %d lines != %d (expected)\n", globs[i], n_matches[i], expected);
+		panic_cond(first_match_ind[i] == first && first_match_len[i] == first_len,
+			   "Glob (%s) first match is (%d,%d) != (%d,%d) (expected)\n", globs[i],
+			   first_match_ind[i], first_match_len[i], first, first_len);
+		expected_total += expected;
+	}
+	panic_cond(total == expected_total, "rk_glob_scan returns %d != %d (expected)\n", total, expected_total);
+	printf("matched %d globs, %d matching lines\n", n_globs, total);
+	rk_glob_free(gs);
+
+	for (int i = 0; i < n_globs; i++) {
+		free(globs[i]);
+	}
+	free(globs);
+	free(n_matches);
+	free(first_match_ind);
+	free(first_match_len);
+	free(doc);
+	printf("-- test_glob: OK --\n");
+}
+
+void
+test_topk()
+{
+	printf("== test_topk ===\n");
+	// plant a few snippets many times each in a random document
+	int n_planted = 5, m = 12, k = 10;
+	int planted_count[] = {300, 250, 200, 150, 100};
+	char planted[5][13];
+	char *doc = generate_random_document(test_document_len);
+	for (int p = 0; p < n_planted; p++) {
+		generate_random_word(planted[p], m);
+		for (int j = 0; j < planted_count[p]; j++) {
+			memcpy(doc + rand() % (test_document_len - m), planted[p], m);
+		}
+	}
+	char fname[] = "/tmp/rkgrep_test_XXXXXX";
+	int fd = mkstemp(fname);
+	panic_cond(fd >= 0, "cannot create %s\n", fname);
+	panic_cond(write(fd, doc, test_document_len) == test_document_len, "cannot write %s\n", fname);
+	close(fd);
+
+	for (int dual = 0; dual < 2; dual++) {
+		rk_sketch *sk = rk_sketch_init(k, m, CMS_WIDTH);
+		struct timespec ts1, ts2;
+		clock_gettime(CLOCK_REALTIME, &ts1);
+		rk_topk_scan(sk, doc, dual ? RK_DUAL_HASH : 0);
+		clock_gettime(CLOCK_REALTIME, &ts2);
+		rk_topk_sort(sk);
+		long err = rk_sketch_error(sk);
+		panic_cond(sk->n == test_document_len - m + 1, "sketch counted %ld windows != %d (expected)\n", sk->n, test_document_len - m + 1);
+		panic_cond(sk->n_top == k, "sketch kept %d heavy hitters != %d (expected)\n", sk->n_top, k);
+		char snippet[13];
+		for (int i = 0; i < sk->n_top; i++) {
+			memcpy(snippet, sk->top[i].gram, m);
+			snippet[m] = '\0';
+			int first;
+			int expected = count_occurrences(snippet, doc, &first);
+			panic_cond(sk->top[i].count >= expected && sk->top[i].count <= expected + err,
+				   "Snippet (%s) has estimated count %ld, not in [%d,%ld]\n", snippet, sk->top[i].count, expected, expected + err);
+			for (int j = 0; j < i; j++) {
+				panic_cond(memcmp(sk->top[j].gram, snippet, m) != 0,
+					   "Snippet (%s) is reported twice\n", snippet);
+			}
+			// the planted snippets (whose counts are far apart) come first, in order
+			if (i < n_planted) {
+				panic_cond(strcmp(snippet, planted[i]) == 0, "Snippet (%s) is at rank %d instead of (%s)\n", snippet, i, planted[i]);
+			}
+		}
+		printf("top %d of %ld %d-grams (%s hash) in %lld microseconds with %ld KB, error bound %ld\n", k, sk->n, m,
+		       dual ? "dual" : "single", timediff(ts2, ts1), (long)CMS_DEPTH*sk->width*sizeof(uint32_t)/1024, err);
+
+		// reading the file in chunks (some smaller than a k-gram) gives the same sketch
+		int buf_sizes[] = {5, 4096, 0};
+		for (int b = 0; b < 3; b++) {
+			rk_sketch *fsk = rk_sketch_init(k, m, CMS_WIDTH);
+			panic_cond(rk_topk_scan_file(fsk, fname, buf_sizes[b], dual ? RK_DUAL_HASH : 0) == 0,
+				   "rk_topk_scan_file cannot read %s\n", fname);
+			rk_topk_sort(fsk);
+			panic_cond(fsk->n == sk->n, "sketch of the file counted %ld windows != %ld (expected)\n", fsk->n, sk->n);
+			panic_cond(fsk->n_top == sk->n_top, "sketch of the file kept %d heavy hitters != %d (expected)\n",
+				   fsk->n_top, sk->n_top);
+			for (int i = 0; i < sk->n_top; i++) {
+				panic_cond(fsk->top[i].count == sk->top[i].count && memcmp(fsk->top[i].gram, sk->top[i].gram, m) == 0,
+					   "heavy hitter %d of the file read %d bytes at a time differs\n", i, buf_sizes[b]);
+			}
+			rk_sketch_free(fsk);
+		}
+		rk_sketch_free(sk);
+	}
+	unlink(fname);
+	free(doc);
+	printf("-- test_topk: OK --\n");
+}
+
+static int
+cmp_long_long(const void *a, const void *b)
+{
+	long long x = *(const long long *)a, y = *(const long long *)b;
+	return (x > y) - (x < y);
+}
+
+// jaccard_ref computes the exact Jaccard similarity of the sets of m-grams of x and y
+// (identified by their dual hashes)
+static double
+jaccard_ref(const char *x, const char *y, int m)
+{
+	const char *docs[2] = {x, y};
+	long long *sets[2];
+	int n[2];
+	for (int d = 0; d < 2; d++) {
+		int len = strlen(docs[d]);
+		sets[d] = (long long *)malloc(sizeof(long long)*(len - m + 1));
+		n[d] = 0;
+		for (int i = 0; i + m <= len; i++) {
+			long long h;
+			sets[d][n[d]++] = rkhash2_init(docs[d] + i, m, &h);
+		}
+		qsort(sets[d], n[d], sizeof(long long), cmp_long_long);
+		int u = 0;
+		for (int i = 0; i < n[d]; i++) {
+			if (u == 0 || sets[d][i] != sets[d][u-1]) {
+				sets[d][u++] = sets[d][i];
+			}
+		}
+		n[d] = u;
+	}
+	int common = 0;
+	for (int i = 0, j = 0; i < n[0] && j < n[1]; ) {
+		if (sets[0][i] == sets[1][j]) {
+			common++;
+			i++;
+			j++;
+		} else if (sets[0][i] < sets[1][j]) {
+			i++;
+		} else {
+			j++;
+		}
+	}
+	free(sets[0]);
+	free(sets[1]);
+	return (double)common/(n[0] + n[1] - common);
+}
+
+void
+test_minhash()
+{
+	printf("== test_minhash ===\n");
+	// random documents, where every odd document is a mutated copy of the previous one
+	int n_docs = 40, doc_len = 5000, m = 8;
+	double mutate[] = {0.005, 0.02, 0.1, 0.5};
+	char **docs = (char **)malloc(sizeof(char *)*n_docs);
+	for (int d = 0; d < n_docs; d++) {
+		docs[d] = generate_random_document(doc_len);
+		if (d % 2 && d < 16) {
+			double p = mutate[(d/2) % 4];
+			for (int i = 0; i < doc_len; i++) {
+				docs[d][i] = (rand() < p*RAND_MAX) ? 'a' + rand() % 26 : docs[d-1][i];
+			}
+		}
+	}
+	rk_minhash *sigs = (rk_minhash *)malloc(sizeof(rk_minhash)*n_docs);
+	struct timespec ts1, ts2;
+	clock_gettime(CLOCK_REALTIME, &ts1);
+	for (int d = 0; d < n_docs; d++) {
+		rk_minhash_doc(docs[d], m, RK_DUAL_HASH, &sigs[d]);
+	}
+	clock_gettime(CLOCK_REALTIME, &ts2);
+	printf("computed %d signatures in %lld microseconds\n", n_docs, timediff(ts2, ts1));
+
+	// the estimates are close to the exact similarities (the standard deviation of an
+	// estimate is at most 0.5/sqrt(MINHASH_SIZE) ~ 0.044)
+	for (int d = 1; d < 16; d += 2) {
+		for (int e = d - 1; e <= d + 1; e += 2) {
+			double exact = jaccard_ref(docs[d], docs[e], m);
+			double est = rk_minhash_similarity(&sigs[d], &sigs[e]);
+			panic_cond(est > exact - 0.2 && est < exact + 0.2, "documents %d and %d have similarity %.3f, estimated %.3f\n", d, e, exact, est);
+		}
+	}
+
+	rk_dup_pair *pairs;
+	double threshold = 0.5;
+	int n_pairs = rk_lsh_pairs(sigs, n_docs, LSH_BANDS, threshold, &pairs);
+	int found[8] = {0};
+	for (int i = 0; i < n_pairs; i++) {
+		panic_cond(pairs[i].a < pairs[i].b && (i == 0 || pairs[i-1].a < pairs[i].a ||
+			   (pairs[i-1].a == pairs[i].a && pairs[i-1].b < pairs[i].b)), "pairs are not ordered and unique\n");
+		panic_cond(pairs[i].sim >= threshold, "pair (%d,%d) has similarity %.3f < %.3f\n", pairs[i].a, pairs[i].b, pairs[i].sim, threshold);
+		double exact = jaccard_ref(docs[pairs[i].a], docs[pairs[i].b], m);
+		panic_cond(exact > 0.3, "pair (%d,%d) reported with similarity %.3f\n", pairs[i].a, pairs[i].b, exact);
+		if (pairs[i].b == pairs[i].a + 1 && pairs[i].b % 2 && pairs[i].b < 16) {
+			found[pairs[i].b/2] = 1;
+		}
+	}
+	for (int d = 1; d < 16; d += 2) {
+		double exact = jaccard_ref(docs[d-1], docs[d], m);
+		panic_cond(found[d/2] || exact < 0.7, "pair (%d,%d) with similarity %.3f not found\n", d-1, d, exact);
+	}
+	printf("found %d near-duplicate pairs among %d documents\n", n_pairs, n_docs);
+
+	free(pairs);
+	free(sigs);
+	for (int d = 0; d < n_docs; d++) {
+		free(docs[d]);
+	}
+	free(docs);
+	printf("-- test_minhash: OK --\n");
+}
+
+void
+test_pipe()
+{
+	printf("== test_pipe ===\n");
+	char *doc = generate_random_document(test_document_len);
+	char fname[] = "/tmp/rkgrep_test_XXXXXX";
+	int fd = mkstemp(fname);
+	panic_cond(fd >= 0, "cannot create %s\n", fname);
+	panic_cond(write(fd, doc, test_document_len) == test_document_len, "cannot write %s\n", fname);
+	close(fd);
+
+	// patterns that straddle the boundaries of 4KB buffers, and a few random ones
+	int n_patterns = 60;
+	char **patterns = (char **)malloc(sizeof(char *)*n_patterns);
+	for (int i = 0; i < n_patterns; i++) {
+		int len = (i == 0) ? 5000 : 1 + rand() % 30;
+		int pos = (i % 3 == 0) ? rand() % (test_document_len - len) :
+			  ((1 + rand() % (test_document_len/4096 - 1))*4096 - rand() % len);
+		patterns[i] = (char *)malloc(len + 1);
+		memcpy(patterns[i], doc + pos, len);
+		patterns[i][len] = '\0';
+	}
+	rk_patterns *ps = rk_patterns_compile(patterns, n_patterns, 0);
+	int *expected = (int *)malloc(sizeof(int)*n_patterns);
+	int *expected_first = (int *)malloc(sizeof(int)*n_patterns);
+	int expected_total = rk_patterns_scan(ps, doc, expected, expected_first);
+
+	int *n_matches = (int *)malloc(sizeof(int)*n_patterns);
+	long long *first_match_off = (long long *)malloc(sizeof(long long)*n_patterns);
+	int configs[][3] = {{1, 4096, 0}, {3, 4096, 0}, {4, 8192, PIPE_DIRECT}, {2, 0, 0}};
+	for (int c = 0; c < 4; c++) {
+		struct timespec ts1, ts2;
+		clock_gettime(CLOCK_REALTIME, &ts1);
+		int total = rk_pipe_scan(fname, ps, configs[c][0], configs[c][1], configs[c][2], n_matches, first_match_off);
+		clock_gettime(CLOCK_REALTIME, &ts2);
+		panic_cond(total == expected_total, "rk_pipe_scan returns %d != %d (expected)\n", total, expected_total);
+		for (int i = 0; i < n_patterns; i++) {
+			panic_cond(n_matches[i] == expected[i], "Pattern %d has %d matches != %d (expected)\n", i, n_matches[i], expected[i]);
+			panic_cond(first_match_off[i] == expected_first[i], "Pattern %d first found at %lld != %d (expected)\n",
+				   i, first_match_off[i], expected_first[i]);
+		}
+		printf("%d threads, %d byte buffers%s: %d matches in %lld microseconds\n", configs[c][0],
+		       configs[c][1] ? configs[c][1] : PIPE_BUF_SIZE, (configs[c][2] & PIPE_DIRECT) ? " (O_DIRECT)" : "",
+		       total, timediff(ts2, ts1));
+	}
+
+	int count = rk_pipe_scan(fname, ps, 3, 4096, PIPE_COUNT, NULL, NULL);
+	panic_cond(count == expected_total, "rk_pipe_scan(PIPE_COUNT) returns %d != %d (expected)\n", count, expected_total);
+	rk_patterns_free(ps);
+
+	// -q stops at the first match: with a match near the start, little of the document is scanned
+	char near_start[11];
+	memcpy(near_start, doc + 100, 10);
+	near_start[10] = '\0';
+	char *early[] = {near_start, patterns[1]};
+	for (int n = 1; n <= 2; n++) {
+		ps = rk_patterns_compile(early, n, 0);
+		long windows = rk_stat.windows_hashed;
+		int exists = rk_patterns_exists_range(ps, doc, test_document_len, 0, test_document_len);
+		windows = rk_stat.windows_hashed - windows;
+		panic_cond(exists == 1, "rk_patterns_exists_range returns %d != 1 (expected)\n", exists);
+		panic_cond(windows < test_document_len/2, "rk_patterns_exists_range hashed %ld windows after the first match\n", windows);
+		panic_cond(rk_pipe_scan(fname, ps, 2, 4096, PIPE_EXISTS, NULL, NULL) == 1, "rk_pipe_scan(PIPE_EXISTS) did not find (%s)\n", near_start);
+		rk_patterns_free(ps);
+	}
+	char *absent[] = {"0123456789", "ABCDEFGHIJKLMNOPQRSTUVWXYZ"};
+	ps = rk_patterns_compile(absent, 2, 0);
+	panic_cond(rk_pipe_scan(fname, ps, 2, 4096, PIPE_EXISTS, NULL, NULL) == 0, "rk_pipe_scan(PIPE_EXISTS) found absent patterns\n");
+	rk_patterns_free(ps);
+	unlink(fname);
+
+	for (int i = 0; i < n_patterns; i++) {
+		free(patterns[i]);
+	}
+	free(patterns);
+	free(expected);
+	free(expected_first);
+	free(n_matches);
+	free(first_match_off);
+	free(doc);
+	printf("-- test_pipe: OK --\n");
+}
+
+// write_file creates the file path with the n bytes of buf
+static void
+write_file(const char *path, const char *buf, int n)
+{
+	int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	panic_cond(fd >= 0, "cannot create %s\n", path);
+	panic_cond(write(fd, buf, n) == n, "cannot write %s\n", path);
+	close(fd);
+}
+
+// scan_quietly runs rk_scan_tree with its matched lines sent to /dev/null
+static int
+scan_quietly(const char *dir, const rk_patterns *ps, int n_threads)
+{
+	fflush(stdout);
+	int saved = dup(STDOUT_FILENO);
+	int null = open("/dev/null", O_WRONLY);
+	panic_cond(saved >= 0 && null >= 0, "cannot redirect stdout\n");
+	dup2(null, STDOUT_FILENO);
+	close(null);
+	int files_matched = rk_scan_tree(dir, ps, n_threads);
+	fflush(stdout);
+	dup2(saved, STDOUT_FILENO);
+	close(saved);
+	return files_matched;
+}
+
+void
+test_scan()
+{
+	printf("== test_scan ===\n");
+	char dir[] = "/tmp/rkgrep_scan_XXXXXX";
+	panic_cond(mkdtemp(dir) != NULL, "cannot create %s\n", dir);
+	char path[256];
+	char *subdirs[] = {"a", "a/b", "c"};
+	for (int d = 0; d < 3; d++) {
+		snprintf(path, sizeof(path), "%s/%s", dir, subdirs[d]);
+		panic_cond(mkdir(path, 0755) == 0, "cannot create %s\n", path);
+	}
+	char pattern[2][13];
+	generate_random_word(pattern[0], 12);
+	generate_random_word(pattern[1], 12);
+	char *pats[] = {pattern[0], pattern[1]};
+
+	// more small files than fit in one task, every third one containing a pattern
+	int n_small = 3*SCAN_BATCH_FILES, small_len = 2000, expected = 0;
+	for (int i = 0; i < n_small; i++) {
+		char *doc = generate_random_document(small_len);
+		if (i % 3 == 0) {
+			memcpy(doc + rand() % (small_len - 12), pattern[i % 2], 12);
+		}
+		int first;
+		if (count_occurrences(pattern[0], doc, &first) + count_occurrences(pattern[1], doc, &first) > 0) {
+			expected++;
+		}
+		snprintf(path, sizeof(path), "%s/%s/f%d", dir, subdirs[i % 3], i);
+		write_file(path, doc, small_len);
+		free(doc);
+	}
+	// an empty file, and a file scanned in chunks with a match across a chunk boundary
+	snprintf(path, sizeof(path), "%s/empty", dir);
+	write_file(path, "", 0);
+	int large_len = 3*SCAN_CHUNK + 100;
+	char *large = generate_random_document(large_len);
+	memcpy(large + 2*SCAN_CHUNK - 5, pattern[1], 12);
+	expected++;
+	snprintf(path, sizeof(path), "%s/a/b/large", dir);
+	write_file(path, large, large_len);
+	free(large);
+
+	rk_patterns *ps = rk_patterns_compile(pats, 2, 0);
+	int threads[] = {1, 4};
+	for (int t = 0; t < 2; t++) {
+		struct timespec ts1, ts2;
+		clock_gettime(CLOCK_REALTIME, &ts1);
+		int files_matched = scan_quietly(dir, ps, threads[t]);
+		clock_gettime(CLOCK_REALTIME, &ts2);
+		panic_cond(files_matched == expected, "rk_scan_tree matched %d files != %d (expected)\n", files_matched, expected);
+		printf("%d threads: %d of %d files matched in %lld microseconds\n", threads[t], files_matched, n_small + 2,
+		       timediff(ts2, ts1));
+	}
+	snprintf(path, sizeof(path), "%s/missing", dir);
+	panic_cond(scan_quietly(path, ps, 2) == -1, "rk_scan_tree of a missing directory does not return -1\n");
+	rk_patterns_free(ps);
+
+	for (int i = 0; i < n_small; i++) {
+		snprintf(path, sizeof(path), "%s/%s/f%d", dir, subdirs[i % 3], i);
+		unlink(path);
+	}
+	snprintf(path, sizeof(path), "%s/empty", dir);
+	unlink(path);
+	snprintf(path, sizeof(path), "%s/a/b/large", dir);
+	unlink(path);
+	for (int d = 2; d >= 0; d--) {
+		snprintf(path, sizeof(path), "%s/%s", dir, subdirs[d]);
+		rmdir(path);
+	}
+	rmdir(dir);
+	printf("-- test_scan: OK --\n");
+}
+
 int
 main(int argc, char **argv)
 {
@@ -307,6 +1057,20 @@ main(int argc, char **argv)
 					which_test = Bloom;
 				} else if (strcmp(optarg, "rkbloom") == 0) {
 					which_test = RKBloom;
+				} else if (strcmp(optarg, "cuckoo") == 0) {
+					which_test = Cuckoo;
+				} else if (strcmp(optarg, "rkset") == 0) {
+					which_test = RKSet;
+				} else if (strcmp(optarg, "glob") == 0) {
+					which_test = Glob;
+				} else if (strcmp(optarg, "topk") == 0) {
+					which_test = TopK;
+				} else if (strcmp(optarg, "minhash") == 0) {
+					which_test = MinHash;
+				} else if (strcmp(optarg, "pipe") == 0) {
+					which_test = Pipe;
+				} else if (strcmp(optarg, "scan") == 0) {
+					which_test = Scan;
 				} else {
 					printf("unknown test type %s", optarg);
 				       	exit(1);
@@ -348,4 +1112,32 @@ main(int argc, char **argv)
 	if (which_test == RKBloom || which_test == All) {
 	       	test_rk_bloom();
 	}
+
+	if (which_test == Cuckoo || which_test == All) {
+	       	test_cuckoo();
+	}
+
+	if (which_test == RKSet || which_test == All) {
+	       	test_rk_patterns();
+	}
+
+	if (which_test == Glob || which_test == All) {
+	       	test_glob();
+	}
+
+	if (which_test == TopK || which_test == All) {
+	       	test_topk();
+	}
+
+	if (which_test == MinHash || which_test == All) {
+	       	test_minhash();
+	}
+
+	if (which_test == Pipe || which_test == All) {
+	       	test_pipe();
+	}
+
+	if (which_test == Scan || which_test == All) {
+	       	test_scan();
+	}
 }
@@ -0,0 +1,200 @@
+/***********************************************************
+ File Name: rkminhash.c
+ Description: near-duplicate documents with MinHash and LSH
+ **********************************************************/
+
+#include <assert.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+
+#include "rkgrep.h"
+#include "rkpatterns.h"
+#include "rkminhash.h"
+#include "rkstats.h"
+
+/* The similarity of two documents is the Jaccard similarity of their sets of m-grams
+ * ("shingles"): |A & B| / |A | B|. For a random hash function, the smallest hash of A
+ * equals the smallest hash of B with exactly that probability, so the fraction of equal
+ * values in two MinHash signatures estimates the similarity.
+ * Computing MINHASH_SIZE independent minimums would hash every shingle MINHASH_SIZE
+ * times. Instead we use one permutation hashing: every shingle (its RK hash, mixed) is
+ * hashed once, the top bits pick one of MINHASH_SIZE bins and the minimum is kept per
+ * bin. Bins that stay empty (short documents) borrow the value of the next non-empty
+ * bin, offset by the distance ("densification"), so that the estimate stays unbiased.
+ * A signature thus costs one pass over the document, like a single RK scan.
+ *
+ * To find similar pairs without comparing all pairs of signatures, LSH splits each
+ * signature into bands of r values. Two documents become a candidate pair if all r
+ * values of some band are equal, which happens with probability 1-(1-s^r)^bands for
+ * similarity s: a steep S-curve around (1/bands)^(1/r) (~0.42 for 32 bands of 4).
+ */
+
+// mix64 scrambles all bits of x (the splitmix64 finalizer)
+static inline unsigned long long
+mix64(unsigned long long x)
+{
+	x ^= x >> 30;
+	x *= 0xbf58476d1ce4e5b9ULL;
+	x ^= x >> 27;
+	x *= 0x94d049bb133111ebULL;
+	x ^= x >> 31;
+	return x;
+}
+
+/* rk_minhash_doc computes the MinHash signature of the set of m-grams of the
+ * null-terminated document doc. With RK_DUAL_HASH in flags, the m-grams are hashed
+ * with the dual RK hash.
+ */
+void
+rk_minhash_doc(const char *doc, int m, int flags, rk_minhash *sig)
+{
+	uint32_t v[MINHASH_SIZE];
+	bool filled[MINHASH_SIZE];
+	for (int i = 0; i < MINHASH_SIZE; i++) {
+		v[i] = UINT32_MAX;
+		filled[i] = false;
+	}
+	int len = strlen(doc);
+	if (m > 0 && len >= m) {
+		long long (*hash_init)(const char *, int, long long *) = rkhash_init;
+		long long (*hash_next)(long long, long long, char, char) = rkhash_next;
+		if (flags & RK_DUAL_HASH) {
+			hash_init = rkhash2_init;
+			hash_next = rkhash2_next;
+		}
+		long long h;
+		long long x = hash_init(doc, m, &h);
+		for (int i = 0; ; i++) {
+			unsigned long long hx = mix64(x);
+			int bin = hx >> 32 & (MINHASH_SIZE - 1);
+			uint32_t val = (uint32_t)hx;
+			if (val <= v[bin]) {
+				v[bin] = val;
+				filled[bin] = true;
+			}
+			if (i + m == len) {
+				break;
+			}
+			x = hash_next(x, h, doc[i], doc[i+m]);
+		}
+		RK_STAT_ADD(bytes_scanned, len);
+		RK_STAT_ADD(windows_hashed, len - m + 1);
+	}
+
+	for (int i = 0; i < MINHASH_SIZE; i++) {
+		sig->v[i] = v[i];
+		if (filled[i]) {
+			continue;
+		}
+		for (int d = 1; d < MINHASH_SIZE; d++) {
+			int j = (i + d) & (MINHASH_SIZE - 1);
+			if (filled[j]) {
+				sig->v[i] = v[j] + d*0x9e3779b9u;
+				break;
+			}
+		}
+	}
+}
+
+/* rk_minhash_similarity estimates the Jaccard similarity of the two documents */
+double
+rk_minhash_similarity(const rk_minhash *x, const rk_minhash *y)
+{
+	int same = 0;
+	for (int i = 0; i < MINHASH_SIZE; i++) {
+		same += x->v[i] == y->v[i];
+	}
+	return (double)same/MINHASH_SIZE;
+}
+
+typedef struct {
+	unsigned long long key;
+	int doc;
+} band_entry;
+
+static int
+cmp_band_entry(const void *a, const void *b)
+{
+	const band_entry *x = (const band_entry *)a, *y = (const band_entry *)b;
+	if (x->key != y->key) {
+		return (x->key > y->key) - (x->key < y->key);
+	}
+	return x->doc - y->doc;
+}
+
+static int
+cmp_dup_pair(const void *a, const void *b)
+{
+	const rk_dup_pair *x = (const rk_dup_pair *)a, *y = (const rk_dup_pair *)b;
+	if (x->a != y->a) {
+		return x->a - y->a;
+	}
+	return x->b - y->b;
+}
+
+/* rk_lsh_pairs finds the near-duplicate pairs among n_docs documents given their
+ * signatures. The signatures are split into bands (which must divide MINHASH_SIZE);
+ * documents that agree on all values of some band are candidates, and a candidate pair
+ * is kept if its estimated similarity is at least threshold.
+ * It stores an array of the pairs (ordered by a, then b) in *pairs, to be freed by
+ * the caller, and returns the number of pairs.
+ */
+int
+rk_lsh_pairs(const rk_minhash *sigs, int n_docs, int bands, double threshold, rk_dup_pair **pairs)
+{
+	assert(bands > 0 && MINHASH_SIZE % bands == 0);
+	int r = MINHASH_SIZE / bands;
+	band_entry *entries = (band_entry *)malloc(sizeof(band_entry)*n_docs);
+	int n_cand = 0, cap = 1024;
+	rk_dup_pair *cand = (rk_dup_pair *)malloc(sizeof(rk_dup_pair)*cap);
+	assert(entries && cand);
+
+	for (int band = 0; band < bands; band++) {
+		// bucket the documents by the hash of their values in this band
+		for (int d = 0; d < n_docs; d++) {
+			unsigned long long key = band;
+			for (int i = band*r; i < (band + 1)*r; i++) {
+				key = mix64(key ^ sigs[d].v[i]);
+			}
+			entries[d].key = key;
+			entries[d].doc = d;
+		}
+		qsort(entries, n_docs, sizeof(band_entry), cmp_band_entry);
+		for (int s = 0, e; s < n_docs; s = e) {
+			for (e = s + 1; e < n_docs && entries[e].key == entries[s].key; e++) {
+			}
+			for (int i = s; i < e; i++) {
+				for (int j = i + 1; j < e; j++) {
+					if (n_cand == cap) {
+						cap *= 2;
+						cand = (rk_dup_pair *)realloc(cand, sizeof(rk_dup_pair)*cap);
+						assert(cand);
+					}
+					cand[n_cand].a = entries[i].doc;
+					cand[n_cand].b = entries[j].doc;
+					n_cand++;
+				}
+			}
+		}
+	}
+	free(entries);
+
+	// a pair may be a candidate in several bands
+	qsort(cand, n_cand, sizeof(rk_dup_pair), cmp_dup_pair);
+	int n = 0;
+	for (int i = 0; i < n_cand; i++) {
+		if (i > 0 && cand[i].a == cand[i-1].a && cand[i].b == cand[i-1].b) {
+			continue;
+		}
+		double sim = rk_minhash_similarity(&sigs[cand[i].a], &sigs[cand[i].b]);
+		if (sim >= threshold) {
+			cand[n] = cand[i];
+			cand[n].sim = sim;
+			n++;
+		}
+	}
+	*pairs = cand;
+	return n;
+}
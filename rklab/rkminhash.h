@@ -0,0 +1,26 @@
+#ifndef __RKMINHASH_H_
+#define __RKMINHASH_H_
+
+#include <stdint.h>
+
+/* number of values in a MinHash signature, must be a power of 2 */
+#define MINHASH_SIZE 128
+/* default number of LSH bands, each made of MINHASH_SIZE/LSH_BANDS signature values */
+#define LSH_BANDS 32
+
+/* MinHash signature of a document's set of shingles (k-grams) */
+typedef struct {
+	uint32_t v[MINHASH_SIZE];
+} rk_minhash;
+
+/* a pair of near-duplicate documents */
+typedef struct {
+	int a, b; /* document indexes, a < b */
+	double sim; /* similarity estimated from their signatures */
+} rk_dup_pair;
+
+void rk_minhash_doc(const char *doc, int m, int flags, rk_minhash *sig);
+double rk_minhash_similarity(const rk_minhash *x, const rk_minhash *y);
+int rk_lsh_pairs(const rk_minhash *sigs, int n_docs, int bands, double threshold, rk_dup_pair **pairs);
+
+#endif
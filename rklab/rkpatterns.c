@@ -0,0 +1,528 @@
+/***********************************************************
+ File Name: rkpatterns.c
+ Description: compile-once pattern sets for Rabin-Karp matching
+ **********************************************************/
+
+#include <assert.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <emmintrin.h>
+
+#include "rkgrep.h"
+#include "rkpatterns.h"
+#include "rkstats.h"
+
+/* rk_substring_match recomputes the pattern's RK hash on every call, and matching
+ * many patterns means one pass over the document per pattern. An rk_patterns object
+ * does the per-pattern work once: patterns are grouped by length, and for each group
+ * we precompute the RK hashes of its patterns, 256^m for rkhash_next, a hash table
+ * from RK hash to pattern, and prefilter masks of the first and last bytes.
+ * Scanning a document then takes one pass per distinct pattern length.
+ * Patterns of at most RK_WORD_MAX_LEN bytes are not hashed at all: each window is
+ * loaded as one 64-bit word (m <= 8) or one SSE register (m <= 16), the bytes past m
+ * are masked off, and the result is compared with the patterns directly. The scan loop
+ * is instantiated once per length, so the load and the mask are constants.
+ */
+
+// word_slot returns the hash table slot of a window (or pattern) whose zero-padded bytes are lo, hi
+static inline int
+word_slot(unsigned long long lo, unsigned long long hi, int tsize)
+{
+	return ((lo * 0x9e3779b97f4a7c15ULL) ^ (hi * 0xc2b2ae3d27d4eb4fULL)) >> 40 & (tsize - 1);
+}
+
+// add_distinct adds byte c to the list bytes[0..*n) unless it's already there.
+// It sets *n to -1 (meaning "too many") once more than RK_SIMD_MAX_BYTES distinct bytes are seen
+static void
+add_distinct(char *bytes, int *n, char c)
+{
+	if (*n < 0) {
+		return;
+	}
+	for (int i = 0; i < *n; i++) {
+		if (bytes[i] == c) {
+			return;
+		}
+	}
+	if (*n == RK_SIMD_MAX_BYTES) {
+		*n = -1;
+		return;
+	}
+	bytes[(*n)++] = c;
+}
+
+static void
+group_init(rk_group *g, rk_patterns *ps, int m)
+{
+	g->m = m;
+	g->hash_init = (ps->flags & RK_DUAL_HASH) ? rkhash2_init : rkhash_init;
+	g->hash_next = (ps->flags & RK_DUAL_HASH) ? rkhash2_next : rkhash_next;
+	g->n = 0;
+	for (int i = 0; i < ps->n_patterns; i++) {
+		g->n += (ps->lens[i] == m);
+	}
+	g->which = (int *)malloc(sizeof(int)*g->n);
+	g->hashes = (long long *)malloc(sizeof(long long)*g->n);
+	g->tsize = 2;
+	while (g->tsize < 2*g->n) {
+		g->tsize <<= 1;
+	}
+	g->table = (int *)calloc(g->tsize, sizeof(int));
+	assert(g->which && g->hashes && g->table);
+	memset(g->last_mask, 0, sizeof(g->last_mask));
+	g->n_first = g->n_last = 0;
+	g->words = NULL;
+	if (m <= RK_WORD_MAX_LEN && !(ps->flags & RK_NO_WORDS)) {
+		g->words = (unsigned long long *)calloc(2*g->n, sizeof(unsigned long long));
+		assert(g->words);
+	}
+
+	int j = 0;
+	for (int i = 0; i < ps->n_patterns; i++) {
+		if (ps->lens[i] != m) {
+			continue;
+		}
+		const char *p = ps->patterns[i];
+		g->which[j] = i;
+		g->hashes[j] = g->hash_init(p, m, &g->h);
+		int s = g->hashes[j] & (g->tsize - 1);
+		if (g->words) {
+			memcpy(&g->words[2*j], p, m);
+			s = word_slot(g->words[2*j], g->words[2*j+1], g->tsize);
+		}
+		while (g->table[s] != 0) {
+			s = (s + 1) & (g->tsize - 1);
+		}
+		g->table[s] = j + 1;
+		unsigned char c = p[m-1];
+		g->last_mask[c >> 3] |= 1 << (c & 7);
+		add_distinct(g->first, &g->n_first, p[0]);
+		add_distinct(g->last, &g->n_last, p[m-1]);
+		j++;
+	}
+	if (g->n_first < 0 || g->n_last < 0) {
+		g->n_first = g->n_last = 0;
+	}
+	if (g->n_first > 0) {
+		g->kernel = RK_KERNEL_SIMD;
+	} else if (g->words) {
+		g->kernel = RK_KERNEL_WORD;
+	} else {
+		g->kernel = RK_KERNEL_ROLLING;
+	}
+}
+
+/* rk_patterns_compile returns a newly allocated pattern set containing copies of
+ * the n_patterns null-terminated strings in patterns. Empty patterns are not allowed.
+ * With RK_DUAL_HASH in flags, windows are hashed with the dual-modulus hash.
+ * With RK_NO_WORDS in flags, short patterns are hashed like long ones.
+ */
+rk_patterns *
+rk_patterns_compile(char **patterns, int n_patterns, int flags)
+{
+	rk_patterns *ps = (rk_patterns *)malloc(sizeof(rk_patterns));
+	ps->flags = flags;
+	ps->n_patterns = n_patterns;
+	ps->patterns = (char **)malloc(sizeof(char *)*n_patterns);
+	ps->lens = (int *)malloc(sizeof(int)*n_patterns);
+	ps->groups = (rk_group *)malloc(sizeof(rk_group)*n_patterns);
+	assert(ps->patterns && ps->lens && ps->groups);
+	ps->n_groups = 0;
+	for (int i = 0; i < n_patterns; i++) {
+		ps->patterns[i] = strdup(patterns[i]);
+		ps->lens[i] = strlen(patterns[i]);
+		assert(ps->lens[i] > 0);
+	}
+	for (int i = 0; i < n_patterns; i++) {
+		int seen = 0;
+		for (int j = 0; j < i; j++) {
+			seen |= (ps->lens[j] == ps->lens[i]);
+		}
+		if (!seen) {
+			group_init(&ps->groups[ps->n_groups++], ps, ps->lens[i]);
+		}
+	}
+	return ps;
+}
+
+void
+rk_patterns_free(rk_patterns *ps)
+{
+	for (int i = 0; i < ps->n_groups; i++) {
+		free(ps->groups[i].which);
+		free(ps->groups[i].hashes);
+		free(ps->groups[i].table);
+		free(ps->groups[i].words);
+	}
+	for (int i = 0; i < ps->n_patterns; i++) {
+		free(ps->patterns[i]);
+	}
+	free(ps->groups);
+	free(ps->lens);
+	free(ps->patterns);
+	free(ps);
+}
+
+// what a scan does with the matches it finds
+enum rk_mode {
+	RK_REPORT, /* per-pattern counts and first positions, and/or a callback */
+	RK_COUNT, /* only the total number of matches */
+	RK_EXISTS, /* stop at the first match */
+};
+
+// where the matches found by a scan go
+typedef struct {
+	enum rk_mode mode;
+	int *n_matches; /* per-pattern match counts (or NULL) */
+	int *first_match_ind; /* per-pattern first match positions (or NULL) */
+	rk_match_fn fn; /* called for every match (or NULL) */
+	void *arg;
+} rk_results;
+
+// record_match records a match of the j-th pattern of the group at doc[pos]
+static inline void
+record_match(const rk_group *g, int j, int pos, const rk_results *r)
+{
+	int p = g->which[j];
+	if (r->n_matches && r->n_matches[p]++ == 0) {
+		r->first_match_ind[p] = pos;
+	}
+	if (r->fn) {
+		r->fn(r->arg, p, pos);
+	}
+	RK_STAT_ADD(true_matches, 1);
+}
+
+// probe looks up the window starting at doc[pos] (whose RK hash is x) among the group's
+// patterns and records a match for every pattern that is equal to the window
+static inline int
+probe(const rk_patterns *ps, const rk_group *g, long long x, const char *doc, int pos,
+      const rk_results *r)
+{
+	int found = 0;
+	for (int s = x & (g->tsize - 1); g->table[s] != 0; s = (s + 1) & (g->tsize - 1)) {
+		int j = g->table[s] - 1;
+		if (g->hashes[j] != x) {
+			continue;
+		}
+		RK_STAT_ADD(hash_hits, 1);
+		RK_STAT_ADD(verifications, 1);
+		if (memcmp(ps->patterns[g->which[j]], doc + pos, g->m) == 0) {
+			record_match(g, j, pos, r);
+			found++;
+			if (r->mode == RK_EXISTS) {
+				break;
+			}
+		} else {
+			RK_STAT_ADD(false_hits, 1);
+		}
+	}
+	return found;
+}
+
+// probe_word looks up the window starting at doc[pos] (whose zero-padded bytes are lo, hi)
+// among the patterns of a word group, and records a match for every equal pattern.
+// Equal words mean equal strings, so there is nothing to verify.
+static inline int
+probe_word(const rk_group *g, unsigned long long lo, unsigned long long hi, int pos,
+	   const rk_results *r)
+{
+	int found = 0;
+	for (int s = word_slot(lo, hi, g->tsize); g->table[s] != 0; s = (s + 1) & (g->tsize - 1)) {
+		int j = g->table[s] - 1;
+		if (g->words[2*j] == lo && g->words[2*j+1] == hi) {
+			RK_STAT_ADD(hash_hits, 1);
+			record_match(g, j, pos, r);
+			found++;
+			if (r->mode == RK_EXISTS) {
+				break;
+			}
+		}
+	}
+	return found;
+}
+
+// load_window returns the m bytes at doc[pos], zero-padded to 16 bytes. It never reads
+// past doc[len-1]. m is a constant in the scan_group_word instantiations.
+static inline __attribute__((always_inline)) __m128i
+load_window(const char *doc, int len, int pos, const int m)
+{
+	if (pos + 16 <= len) {
+		// one unaligned load, then mask off the bytes past m
+		static const char ones[32] = {-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1};
+		__m128i mask = _mm_loadu_si128((const __m128i *)(ones + 16 - m));
+		return _mm_and_si128(_mm_loadu_si128((const __m128i *)(doc + pos)), mask);
+	}
+	unsigned long long w[2] = {0, 0};
+	memcpy(w, doc + pos, m);
+	return _mm_set_epi64x(w[1], w[0]);
+}
+
+// scan_group_word compares every window of length m starting in doc[from..to) with the
+// patterns of a word group. It is always inlined into a scan_group_w<m> function with a
+// constant m (see RK_WORD_KERNEL), so that each window costs a load, a mask and a compare.
+static inline __attribute__((always_inline)) int
+scan_group_word(const rk_group *g, const char *doc, int len, int from, int to,
+		const rk_results *r, const int m)
+{
+	int total = 0;
+	if (g->n == 1 && r->mode == RK_COUNT) {
+		// counting a single pattern: no branch per window at all
+		__m128i p = _mm_loadu_si128((const __m128i *)g->words);
+		for (int i = from; i < to; i++) {
+			total += _mm_movemask_epi8(_mm_cmpeq_epi8(load_window(doc, len, i, m), p)) == 0xffff;
+		}
+		RK_STAT_ADD(hash_hits, total);
+		RK_STAT_ADD(true_matches, total);
+	} else if (g->n == 1) {
+		// a single pattern: compare all 16 bytes at once, no hash table
+		__m128i p = _mm_loadu_si128((const __m128i *)g->words);
+		for (int i = from; i < to; i++) {
+			__m128i w = load_window(doc, len, i, m);
+			if (_mm_movemask_epi8(_mm_cmpeq_epi8(w, p)) == 0xffff) {
+				RK_STAT_ADD(hash_hits, 1);
+				record_match(g, 0, i, r);
+				total++;
+				if (r->mode == RK_EXISTS) {
+					to = i + 1;
+					break;
+				}
+			}
+		}
+	} else {
+		for (int i = from; i < to; i++) {
+			unsigned char c = doc[i+m-1];
+			if (!(g->last_mask[c >> 3] & (1 << (c & 7)))) {
+				continue;
+			}
+			__m128i w = load_window(doc, len, i, m);
+			unsigned long long lo = _mm_cvtsi128_si64(w);
+			unsigned long long hi = (m > 8) ? _mm_cvtsi128_si64(_mm_unpackhi_epi64(w, w)) : 0;
+			total += probe_word(g, lo, hi, i, r);
+			if (total && r->mode == RK_EXISTS) {
+				to = i + 1;
+				break;
+			}
+		}
+	}
+	RK_STAT_ADD(windows_hashed, to - from);
+	return total;
+}
+
+typedef int (*word_kernel)(const rk_group *, const char *, int, int, int, const rk_results *);
+
+#define RK_WORD_KERNEL(M) \
+static int \
+scan_group_w##M(const rk_group *g, const char *doc, int len, int from, int to, const rk_results *r) \
+{ \
+	return scan_group_word(g, doc, len, from, to, r, M); \
+}
+
+RK_WORD_KERNEL(1) RK_WORD_KERNEL(2) RK_WORD_KERNEL(3) RK_WORD_KERNEL(4)
+RK_WORD_KERNEL(5) RK_WORD_KERNEL(6) RK_WORD_KERNEL(7) RK_WORD_KERNEL(8)
+RK_WORD_KERNEL(9) RK_WORD_KERNEL(10) RK_WORD_KERNEL(11) RK_WORD_KERNEL(12)
+RK_WORD_KERNEL(13) RK_WORD_KERNEL(14) RK_WORD_KERNEL(15) RK_WORD_KERNEL(16)
+
+// word_kernels[m] scans a word group of patterns of length m
+static const word_kernel word_kernels[RK_WORD_MAX_LEN + 1] = {
+	NULL, scan_group_w1, scan_group_w2, scan_group_w3, scan_group_w4,
+	scan_group_w5, scan_group_w6, scan_group_w7, scan_group_w8,
+	scan_group_w9, scan_group_w10, scan_group_w11, scan_group_w12,
+	scan_group_w13, scan_group_w14, scan_group_w15, scan_group_w16,
+};
+
+// scan_group_rolling computes the rolling RK hash of every window of length m starting
+// in doc[from..to) and probes the hash table for windows whose last byte ends some pattern
+static int
+scan_group_rolling(const rk_patterns *ps, const rk_group *g, const char *doc, int from, int to,
+		   const rk_results *r)
+{
+	int m = g->m;
+	int total = 0;
+	long long h;
+	long long x = g->hash_init(doc + from, m, &h);
+	for (int i = from; ; i++) {
+		unsigned char c = doc[i+m-1];
+		if (g->last_mask[c >> 3] & (1 << (c & 7))) {
+			total += probe(ps, g, x, doc, i, r);
+			if (total && r->mode == RK_EXISTS) {
+				to = i + 1;
+				break;
+			}
+		}
+		if (i + 1 >= to) {
+			break;
+		}
+		x = g->hash_next(x, g->h, doc[i], doc[i+m]);
+	}
+	RK_STAT_ADD(windows_hashed, to - from);
+	return total;
+}
+
+// any_eq returns a mask of the bytes in v that equal one of the n bytes in splat
+static inline __m128i
+any_eq(__m128i v, const __m128i *splat, int n)
+{
+	__m128i r = _mm_cmpeq_epi8(v, splat[0]);
+	for (int k = 1; k < n; k++) {
+		r = _mm_or_si128(r, _mm_cmpeq_epi8(v, splat[k]));
+	}
+	return r;
+}
+
+// probe_candidate looks up a single window, as a word for a word group, by its RK hash otherwise
+static inline int
+probe_candidate(const rk_patterns *ps, const rk_group *g, const char *doc, int len, int pos,
+		const rk_results *r)
+{
+	RK_STAT_ADD(windows_hashed, 1);
+	if (g->words) {
+		unsigned long long w[2];
+		_mm_storeu_si128((__m128i *)w, load_window(doc, len, pos, g->m));
+		return probe_word(g, w[0], w[1], pos, r);
+	}
+	long long h;
+	return probe(ps, g, g->hash_init(doc + pos, g->m, &h), doc, pos, r);
+}
+
+// scan_group_simd checks the first and last bytes of 16 windows at a time using SSE2
+// and only hashes the (few) windows whose first and last bytes both match some pattern.
+// It is used for groups whose patterns start and end with few distinct bytes.
+// The candidate windows of a word group are compared as words instead of being hashed.
+static int
+scan_group_simd(const rk_patterns *ps, const rk_group *g, const char *doc, int len, int from, int to,
+		const rk_results *r)
+{
+	int m = g->m;
+	int total = 0;
+	__m128i first[RK_SIMD_MAX_BYTES], last[RK_SIMD_MAX_BYTES];
+	for (int k = 0; k < g->n_first; k++) {
+		first[k] = _mm_set1_epi8(g->first[k]);
+	}
+	for (int k = 0; k < g->n_last; k++) {
+		last[k] = _mm_set1_epi8(g->last[k]);
+	}
+
+	int i = from;
+	for (; i + 16 <= to; i += 16) {
+		__m128i a = _mm_loadu_si128((const __m128i *)(doc + i));
+		__m128i b = _mm_loadu_si128((const __m128i *)(doc + i + m - 1));
+		unsigned mask = _mm_movemask_epi8(_mm_and_si128(any_eq(a, first, g->n_first),
+								any_eq(b, last, g->n_last)));
+		while (mask) {
+			int pos = i + __builtin_ctz(mask);
+			mask &= mask - 1;
+			total += probe_candidate(ps, g, doc, len, pos, r);
+			if (total && r->mode == RK_EXISTS) {
+				return total;
+			}
+		}
+	}
+	for (; i < to; i++) {
+		if (memchr(g->first, doc[i], g->n_first) && memchr(g->last, doc[i+m-1], g->n_last)) {
+			total += probe_candidate(ps, g, doc, len, i, r);
+			if (total && r->mode == RK_EXISTS) {
+				return total;
+			}
+		}
+	}
+	return total;
+}
+
+static int
+scan_range(const rk_patterns *ps, const char *doc, int len, int from, int to, const rk_results *r)
+{
+	int total = 0;
+	RK_STAT_ADD(bytes_scanned, (to < len ? to : len) - from);
+	for (int k = 0; k < ps->n_groups; k++) {
+		const rk_group *g = &ps->groups[k];
+		int gto = (to < len - g->m + 1) ? to : (len - g->m + 1);
+		if (from >= gto) {
+			continue;
+		}
+		switch (g->kernel) {
+			case RK_KERNEL_SIMD:
+				total += scan_group_simd(ps, g, doc, len, from, gto, r);
+				break;
+			case RK_KERNEL_WORD:
+				total += word_kernels[g->m](g, doc, len, from, gto, r);
+				break;
+			default:
+				total += scan_group_rolling(ps, g, doc, from, gto, r);
+		}
+		if (total && r->mode == RK_EXISTS) {
+			break;
+		}
+	}
+	return total;
+}
+
+/* rk_patterns_scan_range finds all occurrences of the patterns of ps that start at
+ * positions [from, to) of the len-byte document doc (which need not be null-terminated).
+ * Matches may extend past "to", but not past "len". Splitting a document into ranges
+ * and scanning each range finds each match exactly once.
+ * For each pattern i, it stores the number of occurrences in n_matches[i], and the
+ * first position (counted from the start of doc) in first_match_ind[i] (-1 if not found).
+ * It returns the total number of matches. ps is not modified.
+ */
+int
+rk_patterns_scan_range(const rk_patterns *ps, const char *doc, int len, int from, int to,
+		       int *n_matches, int *first_match_ind)
+{
+	for (int i = 0; i < ps->n_patterns; i++) {
+		n_matches[i] = 0;
+		first_match_ind[i] = -1;
+	}
+	rk_results r = {RK_REPORT, n_matches, first_match_ind, NULL, NULL};
+	return scan_range(ps, doc, len, from, to, &r);
+}
+
+/* rk_patterns_foreach is like rk_patterns_scan_range, except that instead of counting
+ * matches it calls fn(arg, i, pos) for every occurrence of pattern i at position pos.
+ * Within one pattern length, matches are reported in increasing order of position,
+ * but matches of patterns of different lengths are not ordered.
+ * It returns the total number of matches.
+ */
+int
+rk_patterns_foreach(const rk_patterns *ps, const char *doc, int len, int from, int to,
+		    rk_match_fn fn, void *arg)
+{
+	rk_results r = {RK_REPORT, NULL, NULL, fn, arg};
+	return scan_range(ps, doc, len, from, to, &r);
+}
+
+/* rk_patterns_count_range returns the total number of occurrences of the patterns of ps
+ * that start at positions [from, to) of the len-byte document doc (see
+ * rk_patterns_scan_range). It keeps no per-pattern results, so a document with many
+ * matches is scanned faster.
+ */
+int
+rk_patterns_count_range(const rk_patterns *ps, const char *doc, int len, int from, int to)
+{
+	rk_results r = {RK_COUNT, NULL, NULL, NULL, NULL};
+	return scan_range(ps, doc, len, from, to, &r);
+}
+
+/* rk_patterns_exists_range returns 1 if some pattern of ps occurs at a position in
+ * [from, to) of the len-byte document doc, and 0 otherwise. It stops scanning at the
+ * first (verified) match.
+ */
+int
+rk_patterns_exists_range(const rk_patterns *ps, const char *doc, int len, int from, int to)
+{
+	rk_results r = {RK_EXISTS, NULL, NULL, NULL, NULL};
+	return scan_range(ps, doc, len, from, to, &r) > 0;
+}
+
+/* rk_patterns_scan finds all patterns of ps in the null-terminated document doc.
+ * For each pattern i, it stores the number of positions where the pattern is found in
+ * n_matches[i], and the first such position in first_match_ind[i] (-1 if not found).
+ * It returns the total number of matches. ps is not modified.
+ */
+int
+rk_patterns_scan(const rk_patterns *ps, const char *doc, int *n_matches, int *first_match_ind)
+{
+	int len = strlen(doc);
+	return rk_patterns_scan_range(ps, doc, len, 0, len, n_matches, first_match_ind);
+}
@@ -0,0 +1,67 @@
+#ifndef __RKPATTERNS_H_
+#define __RKPATTERNS_H_
+
+/* the SIMD prefilter is used for a group whose patterns start (and end) with at most this many distinct bytes */
+#define RK_SIMD_MAX_BYTES 4
+
+/* patterns up to this long are compared as whole words instead of being hashed */
+#define RK_WORD_MAX_LEN 16
+
+/* rk_patterns_compile flags */
+#define RK_DUAL_HASH 1 /* use the 64-bit dual-modulus hash (rkhash2_*) instead of rkhash_* */
+#define RK_NO_WORDS 2 /* hash short patterns too, instead of comparing them as words */
+
+/* how a group is scanned, chosen by rk_patterns_compile */
+enum rk_kernel {
+	RK_KERNEL_ROLLING, /* rolling RK hash of every window */
+	RK_KERNEL_SIMD, /* SSE2 prefilter on the first and last bytes of the windows */
+	RK_KERNEL_WORD, /* every window loaded as one or two words, specialized per length */
+};
+
+/* patterns of the same length are scanned together as one group */
+typedef struct {
+	int m; /* length of every pattern in this group */
+	long long (*hash_init)(const char *, int, long long *); /* rkhash_init or rkhash2_init */
+	long long (*hash_next)(long long, long long, char, char); /* rkhash_next or rkhash2_next */
+	long long h; /* 256^m as returned by hash_init, used by hash_next */
+	int n; /* number of patterns in this group */
+	int *which; /* which[j] is the index (in rk_patterns) of the j-th pattern of the group */
+	long long *hashes; /* hashes[j] is the RK hash of the j-th pattern of the group */
+	int tsize; /* size of the hash table (a power of 2) */
+	int *table; /* open-addressing hash table from RK hash to j+1 (0 means empty) */
+	unsigned char last_mask[32]; /* bitmap of the last bytes of the group's patterns */
+	int n_first; /* number of distinct first bytes, or 0 if more than RK_SIMD_MAX_BYTES */
+	char first[RK_SIMD_MAX_BYTES]; /* the distinct first bytes (for the SIMD prefilter) */
+	int n_last; /* number of distinct last bytes, or 0 if more than RK_SIMD_MAX_BYTES */
+	char last[RK_SIMD_MAX_BYTES]; /* the distinct last bytes (for the SIMD prefilter) */
+	int kernel; /* enum rk_kernel */
+	unsigned long long *words; /* if m <= RK_WORD_MAX_LEN (or NULL): words[2*j] and words[2*j+1] hold the
+				      bytes of the j-th pattern, zero-padded, and the hash table is keyed by them */
+} rk_group;
+
+/* A compiled set of patterns. It is immutable after rk_patterns_compile,
+ * so it can be shared by many threads scanning different documents.
+ */
+typedef struct {
+	int flags;
+	int n_patterns;
+	char **patterns; /* private copies of the patterns */
+	int *lens;
+	int n_groups;
+	rk_group *groups;
+} rk_patterns;
+
+rk_patterns *rk_patterns_compile(char **patterns, int n_patterns, int flags);
+int rk_patterns_scan(const rk_patterns *ps, const char *doc, int *n_matches, int *first_match_ind);
+int rk_patterns_scan_range(const rk_patterns *ps, const char *doc, int len, int from, int to,
+			   int *n_matches, int *first_match_ind);
+
+/* called by rk_patterns_foreach for every occurrence of pattern i at position pos */
+typedef void (*rk_match_fn)(void *arg, int i, int pos);
+int rk_patterns_foreach(const rk_patterns *ps, const char *doc, int len, int from, int to,
+			rk_match_fn fn, void *arg);
+int rk_patterns_count_range(const rk_patterns *ps, const char *doc, int len, int from, int to);
+int rk_patterns_exists_range(const rk_patterns *ps, const char *doc, int len, int from, int to);
+void rk_patterns_free(rk_patterns *ps);
+
+#endif
@@ -0,0 +1,329 @@
+/***********************************************************
+ File Name: rkpipe.c
+ Description: read-ahead pipeline overlapping file reads and matching
+ **********************************************************/
+
+#define _GNU_SOURCE /* for O_DIRECT */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "rkpatterns.h"
+#include "rkpipe.h"
+#include "rkstats.h"
+
+/* Reading a whole file before matching leaves the CPU idle while the disk works and the
+ * other way around. rk_pipe_scan instead runs one reader thread that fills a ring of
+ * buffers in file order, while n_threads matcher threads scan the buffers that have
+ * already been filled. On a cold cache, the time is close to max(read, match) instead
+ * of read + match.
+ * A window that straddles two buffers is scanned with the second one: the reader copies
+ * the last maxlen-1 bytes of each buffer into the "headroom" just before the data of
+ * the next buffer, and the matcher of a buffer leaves the window starts in those bytes
+ * to the next buffer (except for the last buffer of the file). Each buffer can thus be
+ * scanned on its own, in any order, and each window is scanned exactly once. The
+ * rolling hash restarts once per buffer, i.e. once per PIPE_BUF_SIZE bytes.
+ */
+
+enum buf_state {BufFree, BufFull, BufBusy};
+
+typedef struct {
+	char *mem; /* headroom + buf_size bytes, aligned to PIPE_ALIGN */
+	char *data; /* mem + headroom, where the reader reads to */
+	int hlen; /* bytes of the previous buffer copied just before data */
+	int n; /* bytes read into data */
+	long long off; /* file offset of data[0] */
+	int last; /* the file ends with this buffer */
+	long seq; /* the position of this buffer in the file, in buffers */
+	enum buf_state state;
+} pipe_buf;
+
+typedef struct {
+	const rk_patterns *ps;
+	int fd;
+	int flags;
+	int direct; /* fd was opened with O_DIRECT */
+	int maxlen; /* length of the longest pattern */
+	int buf_size;
+	int n_bufs;
+	pipe_buf *bufs;
+	pthread_mutex_t m;
+	pthread_cond_t filled; /* a buffer became full (or the scan is done) */
+	pthread_cond_t freed; /* a buffer became free */
+	long next_seq; /* the next buffer to be scanned */
+	int done; /* the last buffer has been taken by a matcher (or, with PIPE_EXISTS, a match was found) */
+	int error;
+	int *n_matches;
+	long long *first_match_off;
+	int total;
+	rk_stats stats; /* the counters of the reader and the matchers */
+} pipeline;
+
+// read_full reads up to n bytes, fewer only at the end of the file, and returns the number
+// of bytes read or -1. If the file system refuses O_DIRECT reads, it falls back to normal reads
+static int
+read_full(pipeline *p, char *buf, int n)
+{
+	int done = 0;
+	while (done < n) {
+		int r = read(p->fd, buf + done, n - done);
+		if (r < 0 && errno == EINVAL && p->direct) {
+			p->direct = 0;
+			fcntl(p->fd, F_SETFL, fcntl(p->fd, F_GETFL) & ~O_DIRECT);
+			continue;
+		}
+		if (r < 0) {
+			return -1;
+		}
+		if (r == 0) {
+			break;
+		}
+		done += r;
+	}
+	return done;
+}
+
+static void *
+reader_run(void *arg)
+{
+	pipeline *p = (pipeline *)arg;
+	char *tail = (char *)malloc(p->maxlen);
+	int tlen = 0;
+	long long off = 0;
+	for (long seq = 0; ; seq++) {
+		pipe_buf *b = &p->bufs[seq % p->n_bufs];
+		pthread_mutex_lock(&p->m);
+		while (b->state != BufFree && !p->done) {
+			pthread_cond_wait(&p->freed, &p->m);
+		}
+		int done = p->done;
+		pthread_mutex_unlock(&p->m);
+		if (done) {
+			break;
+		}
+
+		RK_PHASE_START(t_load);
+		int n = read_full(p, b->data, p->buf_size);
+		RK_PHASE_END(t_load, RK_PHASE_LOAD);
+		if (n < 0) {
+			perror("rk_pipe_scan: read ");
+			p->error = 1;
+			n = 0;
+		}
+		memcpy(b->data - tlen, tail, tlen);
+		b->hlen = tlen;
+		b->n = n;
+		b->off = off;
+		b->last = (n < p->buf_size);
+		b->seq = seq;
+		// keep the window starts that this buffer leaves to the next one
+		int len = tlen + n;
+		tlen = (len < p->maxlen - 1) ? len : p->maxlen - 1;
+		memmove(tail, b->data + n - tlen, tlen);
+		off += n;
+
+		pthread_mutex_lock(&p->m);
+		b->state = BufFull;
+		pthread_cond_broadcast(&p->filled);
+		pthread_mutex_unlock(&p->m);
+		if (b->last) {
+			break;
+		}
+	}
+	free(tail);
+	pthread_mutex_lock(&p->m);
+	rk_stats_merge(&p->stats, &rk_stat);
+	pthread_mutex_unlock(&p->m);
+	return NULL;
+}
+
+static void *
+matcher_run(void *arg)
+{
+	pipeline *p = (pipeline *)arg;
+	int n_patterns = p->ps->n_patterns;
+	int *n_matches = (int *)malloc(sizeof(int)*n_patterns);
+	int *first_match_ind = (int *)malloc(sizeof(int)*n_patterns);
+	assert(n_matches && first_match_ind);
+
+	pthread_mutex_lock(&p->m);
+	for (;;) {
+		pipe_buf *b = &p->bufs[p->next_seq % p->n_bufs];
+		while (!p->done && !(b->state == BufFull && b->seq == p->next_seq)) {
+			pthread_cond_wait(&p->filled, &p->m);
+			b = &p->bufs[p->next_seq % p->n_bufs];
+		}
+		if (p->done) {
+			break;
+		}
+		b->state = BufBusy;
+		p->next_seq++;
+		if (b->last) {
+			p->done = 1;
+		}
+		pthread_cond_broadcast(&p->filled);
+		pthread_mutex_unlock(&p->m);
+
+		RK_PHASE_START(t_query);
+		const char *text = b->data - b->hlen;
+		int len = b->hlen + b->n;
+		int to = b->last ? len : len - (p->maxlen - 1);
+		int total;
+		if (p->flags & PIPE_EXISTS) {
+			total = rk_patterns_exists_range(p->ps, text, len, 0, to);
+		} else if (p->flags & PIPE_COUNT) {
+			total = rk_patterns_count_range(p->ps, text, len, 0, to);
+		} else {
+			total = rk_patterns_scan_range(p->ps, text, len, 0, to, n_matches, first_match_ind);
+		}
+		long long base = b->off - b->hlen;
+		RK_PHASE_END(t_query, RK_PHASE_QUERY);
+
+		pthread_mutex_lock(&p->m);
+		p->total += total;
+		b->state = BufFree;
+		pthread_cond_signal(&p->freed);
+		if (total && (p->flags & PIPE_EXISTS)) {
+			// no need to read or scan any further
+			p->done = 1;
+			pthread_cond_broadcast(&p->filled);
+			pthread_cond_broadcast(&p->freed);
+		}
+		if (p->flags & (PIPE_EXISTS | PIPE_COUNT)) {
+			continue;
+		}
+		for (int i = 0; i < n_patterns; i++) {
+			p->n_matches[i] += n_matches[i];
+			if (first_match_ind[i] >= 0 &&
+			    (p->first_match_off[i] < 0 || base + first_match_ind[i] < p->first_match_off[i])) {
+				p->first_match_off[i] = base + first_match_ind[i];
+			}
+		}
+	}
+	rk_stats_merge(&p->stats, &rk_stat);
+	pthread_mutex_unlock(&p->m);
+	free(n_matches);
+	free(first_match_ind);
+	return NULL;
+}
+
+/* rk_pipe_scan finds all patterns of ps in the file fname, reading it in buf_size
+ * chunks (0 means PIPE_BUF_SIZE) on one thread while n_threads threads match.
+ * For each pattern i, it stores the number of occurrences in n_matches[i], and the file
+ * offset of the first one in first_match_off[i] (-1 if not found).
+ * It returns the total number of matches, or -1 if the file cannot be read.
+ * With PIPE_COUNT in flags, it only returns the total, and with PIPE_EXISTS, it returns
+ * 1 as soon as some buffer has a match (0 if the file has none).
+ */
+int
+rk_pipe_scan(const char *fname, const rk_patterns *ps, int n_threads, int buf_size, int flags,
+	     int *n_matches, long long *first_match_off)
+{
+	pipeline p;
+	memset(&p, 0, sizeof(p));
+	p.ps = ps;
+	p.flags = flags;
+	p.direct = (flags & PIPE_DIRECT) != 0;
+	p.fd = open(fname, O_RDONLY | (p.direct ? O_DIRECT : 0));
+	if (p.fd < 0 && p.direct) {
+		p.direct = 0;
+		p.fd = open(fname, O_RDONLY);
+	}
+	if (p.fd < 0) {
+		perror("rk_pipe_scan: open ");
+		return -1;
+	}
+	if (!p.direct) {
+		posix_fadvise(p.fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+	}
+
+	p.maxlen = 1;
+	for (int i = 0; i < ps->n_patterns; i++) {
+		if (ps->lens[i] > p.maxlen) {
+			p.maxlen = ps->lens[i];
+		}
+	}
+	// O_DIRECT reads need aligned sizes, and a buffer must hold the longest pattern
+	if (buf_size <= 0) {
+		buf_size = PIPE_BUF_SIZE;
+	}
+	if (buf_size < p.maxlen) {
+		buf_size = p.maxlen;
+	}
+	p.buf_size = (buf_size + PIPE_ALIGN - 1) / PIPE_ALIGN * PIPE_ALIGN;
+	int headroom = (p.maxlen - 1 + PIPE_ALIGN - 1) / PIPE_ALIGN * PIPE_ALIGN;
+	if (n_threads < 1) {
+		n_threads = 1;
+	}
+	p.n_bufs = n_threads + 2;
+	p.bufs = (pipe_buf *)calloc(p.n_bufs, sizeof(pipe_buf));
+	assert(p.bufs);
+	for (int i = 0; i < p.n_bufs; i++) {
+		void *mem;
+		if (posix_memalign(&mem, PIPE_ALIGN, headroom + p.buf_size) != 0) {
+			fprintf(stderr, "rk_pipe_scan: failed to allocate %d bytes. No memory\n", headroom + p.buf_size);
+			exit(1);
+		}
+		p.bufs[i].mem = (char *)mem;
+		p.bufs[i].data = p.bufs[i].mem + headroom;
+		p.bufs[i].state = BufFree;
+	}
+	pthread_mutex_init(&p.m, NULL);
+	pthread_cond_init(&p.filled, NULL);
+	pthread_cond_init(&p.freed, NULL);
+	for (int i = 0; n_matches && i < ps->n_patterns; i++) {
+		n_matches[i] = 0;
+		first_match_off[i] = -1;
+	}
+	p.n_matches = n_matches;
+	p.first_match_off = first_match_off;
+
+	pthread_t reader;
+	pthread_t *matchers = (pthread_t *)malloc(sizeof(pthread_t)*n_threads);
+	assert(matchers);
+	int n_started = 0;
+	int r = pthread_create(&reader, NULL, reader_run, &p);
+	int reader_started = (r == 0);
+	while (r == 0 && n_started < n_threads) {
+		r = pthread_create(&matchers[n_started], NULL, matcher_run, &p);
+		if (r == 0) {
+			n_started++;
+		}
+	}
+	if (r != 0) {
+		// stop the threads that did start
+		fprintf(stderr, "rk_pipe_scan: pthread_create: %s\n", strerror(r));
+		pthread_mutex_lock(&p.m);
+		p.error = 1;
+		p.done = 1;
+		pthread_cond_broadcast(&p.filled);
+		pthread_cond_broadcast(&p.freed);
+		pthread_mutex_unlock(&p.m);
+	}
+	if (reader_started) {
+		pthread_join(reader, NULL);
+	}
+	for (int i = 0; i < n_started; i++) {
+		pthread_join(matchers[i], NULL);
+	}
+
+	for (int i = 0; i < p.n_bufs; i++) {
+		free(p.bufs[i].mem);
+	}
+	free(p.bufs);
+	free(matchers);
+	pthread_mutex_destroy(&p.m);
+	pthread_cond_destroy(&p.filled);
+	pthread_cond_destroy(&p.freed);
+	close(p.fd);
+	rk_stats_merge(&rk_stat, &p.stats);
+	if (p.error) {
+		return -1;
+	}
+	return (flags & PIPE_EXISTS) ? (p.total > 0) : p.total;
+}
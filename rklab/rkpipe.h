@@ -0,0 +1,19 @@
+#ifndef __RKPIPE_H_
+#define __RKPIPE_H_
+
+#include "rkpatterns.h"
+
+/* default size of one read-ahead buffer */
+#define PIPE_BUF_SIZE (1 << 20)
+/* buffers (and O_DIRECT reads) are aligned to this many bytes */
+#define PIPE_ALIGN 4096
+
+/* rk_pipe_scan flags */
+#define PIPE_DIRECT 1 /* read with O_DIRECT (bypassing the page cache) if the file system allows it */
+#define PIPE_COUNT 2 /* only count the matches, n_matches and first_match_off are not used */
+#define PIPE_EXISTS 4 /* stop reading at the first match and return 1 (0 if there is none) */
+
+int rk_pipe_scan(const char *fname, const rk_patterns *ps, int n_threads, int buf_size, int flags,
+		 int *n_matches, long long *first_match_off);
+
+#endif
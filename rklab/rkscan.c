@@ -0,0 +1,580 @@
+/***********************************************************
+ File Name: rkscan.c
+ Description: parallel recursive search of a directory tree
+ **********************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <assert.h>
+#include <limits.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "rkpatterns.h"
+#include "rkscan.h"
+#include "rkstats.h"
+
+#define NORMALCOLOR "\x1B[0m"
+#define REDCOLOR "\x1B[31m"
+
+/* at most this many characters before and after a match are printed */
+#define SCAN_CONTEXT 200
+
+/* rk_scan_tree searches every regular file under a directory for a compiled set of
+ * patterns, using a pool of worker threads with work stealing.
+ * The (single) walker thread groups the files it finds into tasks of SCAN_BATCH_FILES
+ * files each, and hands the tasks out to the workers' deques round-robin. A worker
+ * takes tasks from the bottom of its own deque and, when that is empty, steals from the
+ * top of another worker's deque. A file larger than SCAN_CHUNK is mmap-ed and split
+ * into chunk tasks that are pushed onto the worker's own deque, so that idle workers
+ * can steal and scan them in parallel. The worker that finishes the last chunk of a
+ * file merges the results of all chunks.
+ * A worker that finds no task anywhere sleeps on a condition variable until a task is
+ * pushed or the scan is over, so idle workers do not take CPU time from busy ones.
+ * Each worker formats the matches of a file into its own output buffer, and only
+ * writes whole files to stdout, so the lines of one file are never interleaved with
+ * those of another.
+ */
+
+// a large file that is being scanned in chunks
+typedef struct {
+	char *path;
+	char *doc; /* the mmap-ed file content */
+	int len;
+	int n_chunks;
+	int pending; /* number of chunks not yet scanned */
+	int *n_matches; /* n_chunks*n_patterns per-chunk match counts */
+	int *first_match_ind; /* n_chunks*n_patterns per-chunk first match positions */
+} file_job;
+
+enum task_kind {Files, Chunk};
+
+typedef struct {
+	enum task_kind kind;
+	int n_files; /* for a Files task */
+	char *paths[SCAN_BATCH_FILES];
+	file_job *job; /* for a Chunk task */
+	int chunk;
+} task;
+
+// a double-ended queue of tasks, the owner pushes and pops at the bottom, thieves steal from the top
+typedef struct {
+	pthread_mutex_t m;
+	task **buf;
+	int cap;
+	long top;
+	long bottom;
+} deque;
+
+typedef struct scanner scanner;
+
+typedef struct {
+	scanner *s;
+	pthread_t tid;
+	deque dq;
+	char *out; /* buffered output */
+	int out_len;
+	int out_cap;
+	char *readbuf; /* holds the content of a small file */
+	int readbuf_cap;
+	int *n_matches; /* per-pattern results of scanning a small file */
+	int *first_match_ind;
+	unsigned seed; /* for picking victims to steal from */
+} worker;
+
+struct scanner {
+	const rk_patterns *ps;
+	int n_workers;
+	worker *workers;
+	long pending; /* number of tasks created but not yet finished */
+	int walk_done; /* set once the walker has created all Files tasks */
+	int files_matched;
+	int errors; /* number of files or directories that could not be searched */
+	pthread_mutex_t idle_m; /* protects pushed, idle workers wait on idle_cv */
+	pthread_cond_t idle_cv;
+	long pushed; /* number of tasks pushed so far, tells idle workers that there is new work */
+	rk_stats stats; /* sum of the workers' rk_stat */
+	pthread_mutex_t out_m; /* serializes writes to stdout */
+	task *batch; /* the Files task currently filled by the walker */
+	int next_worker; /* the walker hands out tasks round-robin */
+};
+
+static void
+dq_init(deque *dq)
+{
+	pthread_mutex_init(&dq->m, NULL);
+	dq->cap = 64;
+	dq->buf = (task **)malloc(sizeof(task *)*dq->cap);
+	assert(dq->buf);
+	dq->top = dq->bottom = 0;
+}
+
+static void
+dq_push(deque *dq, task *t)
+{
+	pthread_mutex_lock(&dq->m);
+	if (dq->bottom - dq->top == dq->cap) {
+		task **buf = (task **)malloc(sizeof(task *)*dq->cap*2);
+		assert(buf);
+		for (long i = dq->top; i < dq->bottom; i++) {
+			buf[i % (dq->cap*2)] = dq->buf[i % dq->cap];
+		}
+		free(dq->buf);
+		dq->buf = buf;
+		dq->cap *= 2;
+	}
+	dq->buf[dq->bottom % dq->cap] = t;
+	dq->bottom++;
+	pthread_mutex_unlock(&dq->m);
+}
+
+static task *
+dq_pop(deque *dq)
+{
+	task *t = NULL;
+	pthread_mutex_lock(&dq->m);
+	if (dq->bottom > dq->top) {
+		dq->bottom--;
+		t = dq->buf[dq->bottom % dq->cap];
+	}
+	pthread_mutex_unlock(&dq->m);
+	return t;
+}
+
+static task *
+dq_steal(deque *dq)
+{
+	task *t = NULL;
+	pthread_mutex_lock(&dq->m);
+	if (dq->bottom > dq->top) {
+		t = dq->buf[dq->top % dq->cap];
+		dq->top++;
+	}
+	pthread_mutex_unlock(&dq->m);
+	return t;
+}
+
+// push_task makes t runnable on worker w, and wakes up an idle worker to run or steal it
+static void
+push_task(scanner *s, worker *w, task *t)
+{
+	__atomic_add_fetch(&s->pending, 1, __ATOMIC_SEQ_CST);
+	dq_push(&w->dq, t);
+	pthread_mutex_lock(&s->idle_m);
+	s->pushed++;
+	pthread_cond_signal(&s->idle_cv);
+	pthread_mutex_unlock(&s->idle_m);
+}
+
+// scan_done reports whether all tasks have been created and finished
+static int
+scan_done(scanner *s)
+{
+	return __atomic_load_n(&s->walk_done, __ATOMIC_SEQ_CST) &&
+	       __atomic_load_n(&s->pending, __ATOMIC_SEQ_CST) == 0;
+}
+
+// wake_all wakes up all idle workers, once the scan is done
+static void
+wake_all(scanner *s)
+{
+	pthread_mutex_lock(&s->idle_m);
+	pthread_cond_broadcast(&s->idle_cv);
+	pthread_mutex_unlock(&s->idle_m);
+}
+
+static void
+flush_output(worker *w)
+{
+	if (w->out_len == 0) {
+		return;
+	}
+	pthread_mutex_lock(&w->s->out_m);
+	fwrite(w->out, 1, w->out_len, stdout);
+	fflush(stdout);
+	pthread_mutex_unlock(&w->s->out_m);
+	w->out_len = 0;
+}
+
+static void
+append_output(worker *w, const char *buf, int n)
+{
+	if (w->out_len + n > w->out_cap) {
+		while (w->out_len + n > w->out_cap) {
+			w->out_cap *= 2;
+		}
+		w->out = (char *)realloc(w->out, w->out_cap);
+		assert(w->out);
+	}
+	memcpy(w->out + w->out_len, buf, n);
+	w->out_len += n;
+}
+
+// append_matched_line buffers "path:line", where the line contains the match of length m at pos
+static void
+append_matched_line(worker *w, const char *path, const char *doc, int len, int pos, int m)
+{
+	int start = pos;
+	while (start > 0 && doc[start-1] != '\n' && pos - start < SCAN_CONTEXT) {
+		start--;
+	}
+	int end = pos + m;
+	while (end < len && doc[end] != '\n' && end - (pos + m) < SCAN_CONTEXT) {
+		end++;
+	}
+	append_output(w, path, strlen(path));
+	append_output(w, ":", 1);
+	append_output(w, doc + start, pos - start);
+	append_output(w, REDCOLOR, strlen(REDCOLOR));
+	append_output(w, doc + pos, m);
+	append_output(w, NORMALCOLOR, strlen(NORMALCOLOR));
+	append_output(w, doc + pos + m, end - (pos + m));
+	append_output(w, "\n", 1);
+}
+
+// report_file buffers the first match of every pattern found in a file
+static void
+report_file(worker *w, const char *path, const char *doc, int len, const int *n_matches, const int *first_match_ind)
+{
+	const rk_patterns *ps = w->s->ps;
+	int matched = 0;
+	for (int i = 0; i < ps->n_patterns; i++) {
+		if (n_matches[i] > 0) {
+			append_matched_line(w, path, doc, len, first_match_ind[i], ps->lens[i]);
+			matched = 1;
+		}
+	}
+	if (matched) {
+		__atomic_add_fetch(&w->s->files_matched, 1, __ATOMIC_RELAXED);
+		if (w->out_len >= SCAN_OUTBUF) {
+			flush_output(w);
+		}
+	}
+}
+
+// start_file_job mmaps a large file and creates one Chunk task per SCAN_CHUNK bytes
+static void
+start_file_job(worker *w, const char *path, int fd, int len)
+{
+	int np = w->s->ps->n_patterns;
+	char *doc = (char *)mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (doc == MAP_FAILED) {
+		perror("rk_scan_tree: mmap ");
+		__atomic_add_fetch(&w->s->errors, 1, __ATOMIC_RELAXED);
+		return;
+	}
+	file_job *job = (file_job *)malloc(sizeof(file_job));
+	job->path = strdup(path);
+	job->doc = doc;
+	job->len = len;
+	job->n_chunks = (len + SCAN_CHUNK - 1) / SCAN_CHUNK;
+	job->pending = job->n_chunks;
+	job->n_matches = (int *)malloc(sizeof(int)*job->n_chunks*np);
+	job->first_match_ind = (int *)malloc(sizeof(int)*job->n_chunks*np);
+	assert(job->n_matches && job->first_match_ind);
+	// push the chunks in reverse, so that the owner scans the file from the front
+	// while thieves take chunks from the back
+	for (int c = job->n_chunks - 1; c >= 0; c--) {
+		task *t = (task *)malloc(sizeof(task));
+		t->kind = Chunk;
+		t->job = job;
+		t->chunk = c;
+		push_task(w->s, w, t);
+	}
+}
+
+static void
+run_chunk(worker *w, file_job *job, int c)
+{
+	const rk_patterns *ps = w->s->ps;
+	int np = ps->n_patterns;
+	int from = c * SCAN_CHUNK;
+	int to = (job->len - from > SCAN_CHUNK) ? from + SCAN_CHUNK : job->len;
+	RK_PHASE_START(t_query);
+	rk_patterns_scan_range(ps, job->doc, job->len, from, to,
+			       &job->n_matches[c*np], &job->first_match_ind[c*np]);
+	RK_PHASE_END(t_query, RK_PHASE_QUERY);
+	if (__atomic_sub_fetch(&job->pending, 1, __ATOMIC_ACQ_REL) != 0) {
+		return;
+	}
+	// this is the last chunk, merge the results of all chunks (in order)
+	for (int i = 0; i < np; i++) {
+		int n = 0, first = -1;
+		for (int k = 0; k < job->n_chunks; k++) {
+			if (first < 0 && job->n_matches[k*np + i] > 0) {
+				first = job->first_match_ind[k*np + i];
+			}
+			n += job->n_matches[k*np + i];
+		}
+		w->n_matches[i] = n;
+		w->first_match_ind[i] = first;
+	}
+	RK_PHASE_START(t_output);
+	report_file(w, job->path, job->doc, job->len, w->n_matches, w->first_match_ind);
+	RK_PHASE_END(t_output, RK_PHASE_OUTPUT);
+	munmap(job->doc, job->len);
+	free(job->n_matches);
+	free(job->first_match_ind);
+	free(job->path);
+	free(job);
+}
+
+static void
+run_file(worker *w, const char *path)
+{
+	RK_PHASE_START(t_load);
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		perror(path);
+		__atomic_add_fetch(&w->s->errors, 1, __ATOMIC_RELAXED);
+		return;
+	}
+	struct stat st;
+	if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+		close(fd);
+		return;
+	}
+	if (st.st_size > INT_MAX) {
+		fprintf(stderr, "%s: file too large, skipped\n", path);
+		__atomic_add_fetch(&w->s->errors, 1, __ATOMIC_RELAXED);
+	} else if (st.st_size > SCAN_CHUNK) {
+		start_file_job(w, path, fd, (int)st.st_size);
+		RK_PHASE_END(t_load, RK_PHASE_LOAD);
+	} else if (st.st_size > 0) {
+		if (st.st_size > w->readbuf_cap) {
+			w->readbuf_cap = st.st_size;
+			w->readbuf = (char *)realloc(w->readbuf, w->readbuf_cap);
+			assert(w->readbuf);
+		}
+		int n = 0;
+		while (n < st.st_size) {
+			int r = read(fd, w->readbuf + n, st.st_size - n);
+			if (r < 0) {
+				perror(path);
+				__atomic_add_fetch(&w->s->errors, 1, __ATOMIC_RELAXED);
+			}
+			if (r <= 0) {
+				break;
+			}
+			n += r;
+		}
+		RK_PHASE_END(t_load, RK_PHASE_LOAD);
+		RK_PHASE_START(t_query);
+		rk_patterns_scan_range(w->s->ps, w->readbuf, n, 0, n, w->n_matches, w->first_match_ind);
+		RK_PHASE_END(t_query, RK_PHASE_QUERY);
+		RK_PHASE_START(t_output);
+		report_file(w, path, w->readbuf, n, w->n_matches, w->first_match_ind);
+		RK_PHASE_END(t_output, RK_PHASE_OUTPUT);
+	}
+	close(fd);
+}
+
+// get_task returns a task from the worker's own deque, or else steals one from another worker
+static task *
+get_task(worker *w)
+{
+	task *t = dq_pop(&w->dq);
+	if (t) {
+		return t;
+	}
+	scanner *s = w->s;
+	int start = rand_r(&w->seed) % s->n_workers;
+	for (int i = 0; i < s->n_workers; i++) {
+		worker *victim = &s->workers[(start + i) % s->n_workers];
+		if (victim != w && (t = dq_steal(&victim->dq)) != NULL) {
+			return t;
+		}
+	}
+	return NULL;
+}
+
+static void *
+worker_run(void *arg)
+{
+	worker *w = (worker *)arg;
+	scanner *s = w->s;
+	for (;;) {
+		pthread_mutex_lock(&s->idle_m);
+		long pushed = s->pushed;
+		pthread_mutex_unlock(&s->idle_m);
+		task *t = get_task(w);
+		if (!t) {
+			// sleep until a task is pushed after we looked, or the scan is done
+			pthread_mutex_lock(&s->idle_m);
+			while (s->pushed == pushed && !scan_done(s)) {
+				pthread_cond_wait(&s->idle_cv, &s->idle_m);
+			}
+			pthread_mutex_unlock(&s->idle_m);
+			if (scan_done(s)) {
+				break;
+			}
+			continue;
+		}
+		if (t->kind == Files) {
+			for (int i = 0; i < t->n_files; i++) {
+				run_file(w, t->paths[i]);
+				free(t->paths[i]);
+			}
+		} else {
+			run_chunk(w, t->job, t->chunk);
+		}
+		free(t);
+		if (__atomic_sub_fetch(&s->pending, 1, __ATOMIC_SEQ_CST) == 0 &&
+		    __atomic_load_n(&s->walk_done, __ATOMIC_SEQ_CST)) {
+			wake_all(s);
+		}
+	}
+	flush_output(w);
+	pthread_mutex_lock(&s->out_m);
+	rk_stats_merge(&s->stats, &rk_stat);
+	pthread_mutex_unlock(&s->out_m);
+	return NULL;
+}
+
+// hand_out gives the walker's current batch of files to the next worker
+static void
+hand_out(scanner *s)
+{
+	if (s->batch && s->batch->n_files > 0) {
+		push_task(s, &s->workers[s->next_worker], s->batch);
+		s->next_worker = (s->next_worker + 1) % s->n_workers;
+		s->batch = NULL;
+	}
+}
+
+static void
+add_file(scanner *s, const char *path)
+{
+	if (!s->batch) {
+		s->batch = (task *)malloc(sizeof(task));
+		s->batch->kind = Files;
+		s->batch->n_files = 0;
+	}
+	s->batch->paths[s->batch->n_files++] = strdup(path);
+	if (s->batch->n_files == SCAN_BATCH_FILES) {
+		hand_out(s);
+	}
+}
+
+// walk visits the directory tree at path, without following symbolic links
+static void
+walk(scanner *s, const char *path)
+{
+	DIR *d = opendir(path);
+	if (!d) {
+		perror(path);
+		__atomic_add_fetch(&s->errors, 1, __ATOMIC_RELAXED);
+		return;
+	}
+	struct dirent *e;
+	char child[PATH_MAX];
+	while ((e = readdir(d)) != NULL) {
+		if (strcmp(e->d_name, ".") == 0 || strcmp(e->d_name, "..") == 0) {
+			continue;
+		}
+		if (snprintf(child, sizeof(child), "%s/%s", path, e->d_name) >= (int)sizeof(child)) {
+			fprintf(stderr, "%s/%s: path too long, skipped\n", path, e->d_name);
+			__atomic_add_fetch(&s->errors, 1, __ATOMIC_RELAXED);
+			continue;
+		}
+		unsigned char type = e->d_type;
+		if (type == DT_UNKNOWN) {
+			struct stat st;
+			if (lstat(child, &st) != 0) {
+				continue;
+			}
+			type = S_ISDIR(st.st_mode) ? DT_DIR : (S_ISREG(st.st_mode) ? DT_REG : DT_UNKNOWN);
+		}
+		if (type == DT_DIR) {
+			walk(s, child);
+		} else if (type == DT_REG) {
+			add_file(s, child);
+		}
+	}
+	closedir(d);
+}
+
+/* rk_scan_tree searches all regular files under directory dir for the patterns in ps
+ * using n_threads worker threads, and prints the first match of each pattern in each
+ * file as "path:line". It returns the number of files with at least one match, or -1 if
+ * some file or directory could not be searched (the matches in the others are printed).
+ */
+int
+rk_scan_tree(const char *dir, const rk_patterns *ps, int n_threads)
+{
+	scanner s;
+	s.ps = ps;
+	s.n_workers = n_threads > 0 ? n_threads : 1;
+	s.workers = (worker *)calloc(s.n_workers, sizeof(worker));
+	assert(s.workers);
+	s.pending = 0;
+	s.walk_done = 0;
+	s.files_matched = 0;
+	s.errors = 0;
+	s.pushed = 0;
+	memset(&s.stats, 0, sizeof(s.stats));
+	s.batch = NULL;
+	s.next_worker = 0;
+	pthread_mutex_init(&s.out_m, NULL);
+	pthread_mutex_init(&s.idle_m, NULL);
+	pthread_cond_init(&s.idle_cv, NULL);
+
+	for (int i = 0; i < s.n_workers; i++) {
+		worker *w = &s.workers[i];
+		w->s = &s;
+		dq_init(&w->dq);
+		w->out_cap = 2*SCAN_OUTBUF;
+		w->out = (char *)malloc(w->out_cap);
+		w->readbuf_cap = 0;
+		w->readbuf = NULL;
+		w->n_matches = (int *)malloc(sizeof(int)*ps->n_patterns);
+		w->first_match_ind = (int *)malloc(sizeof(int)*ps->n_patterns);
+		w->seed = i + 1;
+		assert(w->out && w->n_matches && w->first_match_ind);
+	}
+	int n_started = 0;
+	while (n_started < s.n_workers) {
+		int r = pthread_create(&s.workers[n_started].tid, NULL, worker_run, &s.workers[n_started]);
+		if (r != 0) {
+			fprintf(stderr, "rk_scan_tree: pthread_create: %s\n", strerror(r));
+			__atomic_add_fetch(&s.errors, 1, __ATOMIC_RELAXED);
+			break;
+		}
+		n_started++;
+	}
+
+	// without all its workers, the scan is abandoned (the started ones find no work)
+	if (n_started == s.n_workers) {
+		walk(&s, dir);
+		hand_out(&s);
+	}
+	__atomic_store_n(&s.walk_done, 1, __ATOMIC_SEQ_CST);
+	wake_all(&s);
+
+	for (int i = 0; i < s.n_workers; i++) {
+		worker *w = &s.workers[i];
+		if (i < n_started) {
+			pthread_join(w->tid, NULL);
+		}
+		free(w->out);
+		free(w->readbuf);
+		free(w->n_matches);
+		free(w->first_match_ind);
+		free(w->dq.buf);
+		pthread_mutex_destroy(&w->dq.m);
+	}
+	pthread_mutex_destroy(&s.out_m);
+	pthread_mutex_destroy(&s.idle_m);
+	pthread_cond_destroy(&s.idle_cv);
+	free(s.workers);
+	// the workers did the scanning on behalf of the calling thread
+	rk_stats_merge(&rk_stat, &s.stats);
+	return s.errors ? -1 : s.files_matched;
+}
@@ -0,0 +1,15 @@
+#ifndef __RKSCAN_H_
+#define __RKSCAN_H_
+
+#include "rkpatterns.h"
+
+/* files larger than this are split into chunks of this size, which are scanned in parallel */
+#define SCAN_CHUNK (1 << 20)
+/* how many small files a single task scans */
+#define SCAN_BATCH_FILES 32
+/* a thread writes its buffered output to stdout when the buffer grows past this size */
+#define SCAN_OUTBUF (64 << 10)
+
+int rk_scan_tree(const char *dir, const rk_patterns *ps, int n_threads);
+
+#endif
@@ -0,0 +1,266 @@
+/***********************************************************
+ File Name: rksketch.c
+ Description: most frequent k-grams with a count-min sketch
+ **********************************************************/
+
+#include <assert.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "rkgrep.h"
+#include "rkpatterns.h"
+#include "rksketch.h"
+#include "rkstats.h"
+
+/* Counting every distinct k-gram of a corpus exactly needs memory proportional to the
+ * corpus. Instead, rk_topk_scan streams the RK hash of every window into a count-min
+ * sketch: CMS_DEPTH rows of counters, each indexed by a different hash of the k-gram.
+ * A k-gram's count is estimated as the minimum of its CMS_DEPTH counters, which never
+ * underestimates it. We use the "conservative update": adding a k-gram only raises the
+ * counters that are below its new estimate, which keeps the estimates tighter.
+ * For a row of width w, an estimate exceeds the true count by more than e*n/w (n is the
+ * number of k-grams added) with probability at most e^-CMS_DEPTH.
+ * Next to the sketch, a min-heap keeps the k k-grams with the largest estimates seen
+ * so far, each with a copy of its bytes. rk_topk_scan_file reads the corpus in chunks
+ * of TOPK_BUF_SIZE bytes and carries the last m-1 bytes of a chunk over to the next,
+ * so that the windows across chunk boundaries are counted too. The whole analysis is
+ * one pass, using CMS_DEPTH*width counters, k*m bytes of k-grams and one chunk,
+ * whatever the size of the corpus.
+ * Two different k-grams whose RK hashes collide share their sketch counters (use the
+ * dual hash to make that unlikely), but they are kept apart in the heap.
+ */
+
+// mix64 scrambles all bits of x (the splitmix64 finalizer)
+static inline unsigned long long
+mix64(unsigned long long x)
+{
+	x ^= x >> 30;
+	x *= 0xbf58476d1ce4e5b9ULL;
+	x ^= x >> 27;
+	x *= 0x94d049bb133111ebULL;
+	x ^= x >> 31;
+	return x;
+}
+
+/* rk_sketch_init allocates a sketch with rows of width counters (a power of 2)
+ * that keeps the k most frequent m-grams
+ */
+rk_sketch *
+rk_sketch_init(int k, int m, int width)
+{
+	assert(k > 0 && m > 0 && width > 0 && (width & (width - 1)) == 0);
+	rk_sketch *sk = (rk_sketch *)malloc(sizeof(rk_sketch));
+	sk->width = width;
+	sk->counts = (uint32_t *)calloc((size_t)CMS_DEPTH*width, sizeof(uint32_t));
+	sk->n = 0;
+	sk->m = m;
+	sk->k = k;
+	sk->n_top = 0;
+	sk->top = (rk_heavy *)malloc(sizeof(rk_heavy)*k);
+	sk->grams = (char *)malloc((size_t)k*m);
+	assert(sk->counts && sk->top && sk->grams);
+	return sk;
+}
+
+void
+rk_sketch_free(rk_sketch *sk)
+{
+	free(sk->counts);
+	free(sk->top);
+	free(sk->grams);
+	free(sk);
+}
+
+/* rk_sketch_error returns how much an estimated count may exceed the true count
+ * (with probability 1-e^-CMS_DEPTH)
+ */
+long
+rk_sketch_error(const rk_sketch *sk)
+{
+	return (long)ceil(M_E*sk->n/sk->width);
+}
+
+// cms_add adds one occurrence of the k-gram with hash x and returns its new estimated count
+static inline long
+cms_add(rk_sketch *sk, long long x)
+{
+	// derive the row indexes from two halves of one mixed hash, h1 + r*h2
+	unsigned long long hx = mix64(x);
+	uint32_t h1 = hx, h2 = (hx >> 32) | 1;
+	uint32_t *cell[CMS_DEPTH];
+	uint32_t min = UINT32_MAX;
+	for (int r = 0; r < CMS_DEPTH; r++) {
+		cell[r] = &sk->counts[(size_t)r*sk->width + ((h1 + r*h2) & (sk->width - 1))];
+		if (*cell[r] < min) {
+			min = *cell[r];
+		}
+	}
+	min++;
+	for (int r = 0; r < CMS_DEPTH; r++) {
+		if (*cell[r] < min) {
+			*cell[r] = min;
+		}
+	}
+	sk->n++;
+	return min;
+}
+
+static void
+heap_sift_up(rk_heavy *top, int j)
+{
+	while (j > 0 && top[(j-1)/2].count > top[j].count) {
+		rk_heavy t = top[j];
+		top[j] = top[(j-1)/2];
+		top[(j-1)/2] = t;
+		j = (j-1)/2;
+	}
+}
+
+static void
+heap_sift_down(rk_heavy *top, int n, int j)
+{
+	for (;;) {
+		int c = 2*j + 1;
+		if (c >= n) {
+			return;
+		}
+		if (c + 1 < n && top[c+1].count < top[c].count) {
+			c++;
+		}
+		if (top[j].count <= top[c].count) {
+			return;
+		}
+		rk_heavy t = top[j];
+		top[j] = top[c];
+		top[c] = t;
+		j = c;
+	}
+}
+
+// heap_update records that the k-gram w (with hash x) has estimated count c
+static inline void
+heap_update(rk_sketch *sk, const char *w, long long x, long c)
+{
+	// most k-grams are rare, and are rejected by comparing with the smallest heavy hitter
+	if (sk->n_top == sk->k && c <= sk->top[0].count) {
+		return;
+	}
+	for (int j = 0; j < sk->n_top; j++) {
+		if (sk->top[j].hash == x && memcmp(sk->top[j].gram, w, sk->m) == 0) {
+			sk->top[j].count = c;
+			heap_sift_down(sk->top, sk->n_top, j);
+			return;
+		}
+	}
+	if (sk->n_top < sk->k) {
+		rk_heavy e = {x, sk->grams + (size_t)sk->n_top*sk->m, c};
+		memcpy(e.gram, w, sk->m);
+		sk->top[sk->n_top] = e;
+		heap_sift_up(sk->top, sk->n_top++);
+	} else {
+		// the evicted heavy hitter's copy is reused for the new one
+		memcpy(sk->top[0].gram, w, sk->m);
+		sk->top[0].hash = x;
+		sk->top[0].count = c;
+		heap_sift_down(sk->top, sk->n_top, 0);
+	}
+}
+
+// scan_windows adds all m-grams of buf[0..len) to the sketch and returns their number
+static int
+scan_windows(rk_sketch *sk, const char *buf, int len, int flags)
+{
+	int m = sk->m;
+	if (len < m) {
+		return 0;
+	}
+	long long (*hash_init)(const char *, int, long long *) = rkhash_init;
+	long long (*hash_next)(long long, long long, char, char) = rkhash_next;
+	if (flags & RK_DUAL_HASH) {
+		hash_init = rkhash2_init;
+		hash_next = rkhash2_next;
+	}
+	long long h;
+	long long x = hash_init(buf, m, &h);
+	for (int i = 0; ; i++) {
+		long c = cms_add(sk, x);
+		heap_update(sk, buf + i, x, c);
+		if (i + m == len) {
+			break;
+		}
+		x = hash_next(x, h, buf[i], buf[i+m]);
+	}
+	return len - m + 1;
+}
+
+/* rk_topk_scan adds all m-grams of the null-terminated document doc to the sketch.
+ * With RK_DUAL_HASH in flags, the m-grams are hashed with the dual RK hash.
+ */
+void
+rk_topk_scan(rk_sketch *sk, const char *doc, int flags)
+{
+	int len = strlen(doc);
+	int n = scan_windows(sk, doc, len, flags);
+	RK_STAT_ADD(bytes_scanned, len);
+	RK_STAT_ADD(windows_hashed, n);
+}
+
+/* rk_topk_scan_file adds all m-grams of file fname to the sketch, reading buf_size bytes
+ * at a time (TOPK_BUF_SIZE if buf_size is 0). It returns -1 if the file cannot be read.
+ */
+int
+rk_topk_scan_file(rk_sketch *sk, const char *fname, int buf_size, int flags)
+{
+	int m = sk->m;
+	if (buf_size <= 0) {
+		buf_size = TOPK_BUF_SIZE;
+	}
+	int fd = open(fname, O_RDONLY);
+	if (fd < 0) {
+		perror("rk_topk_scan_file: open ");
+		return -1;
+	}
+	// the first carry bytes of buf are the last m-1 bytes of the previous chunk
+	char *buf = (char *)malloc(m - 1 + buf_size);
+	assert(buf);
+	int carry = 0, ret = 0;
+	for (;;) {
+		int n = read(fd, buf + carry, buf_size);
+		if (n < 0) {
+			perror("rk_topk_scan_file: read ");
+			ret = -1;
+			break;
+		}
+		if (n == 0) {
+			break;
+		}
+		int len = carry + n;
+		RK_STAT_ADD(bytes_scanned, n);
+		RK_STAT_ADD(windows_hashed, scan_windows(sk, buf, len, flags));
+		carry = len < m - 1 ? len : m - 1;
+		memmove(buf, buf + len - carry, carry);
+	}
+	free(buf);
+	close(fd);
+	return ret;
+}
+
+static int
+cmp_heavy(const void *a, const void *b)
+{
+	long x = ((const rk_heavy *)a)->count, y = ((const rk_heavy *)b)->count;
+	return (x < y) - (x > y);
+}
+
+/* rk_topk_sort orders the heavy hitters by decreasing count. No more m-grams
+ * may be added to the sketch afterwards.
+ */
+void
+rk_topk_sort(rk_sketch *sk)
+{
+	qsort(sk->top, sk->n_top, sizeof(rk_heavy), cmp_heavy);
+}
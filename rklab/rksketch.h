@@ -0,0 +1,39 @@
+#ifndef __RKSKETCH_H_
+#define __RKSKETCH_H_
+
+#include <stdint.h>
+
+/* number of rows (hash functions) of a count-min sketch */
+#define CMS_DEPTH 4
+/* default number of counters per row, must be a power of 2 */
+#define CMS_WIDTH (1 << 16)
+/* default number of bytes rk_topk_scan_file reads at a time */
+#define TOPK_BUF_SIZE (1 << 20)
+
+/* a k-gram that is currently among the heavy hitters */
+typedef struct {
+	long long hash; /* its RK hash */
+	char *gram; /* a copy of its m bytes, owned by the sketch */
+	long count; /* its estimated count (an overestimate) */
+} rk_heavy;
+
+typedef struct {
+	int width; /* counters per row */
+	uint32_t *counts; /* CMS_DEPTH rows of width counters */
+	long n; /* number of k-grams added */
+	int m; /* length of the k-grams */
+	int k; /* number of heavy hitters to keep */
+	int n_top; /* number of heavy hitters kept so far */
+	rk_heavy *top; /* min-heap of the heavy hitters, ordered by count */
+	char *grams; /* k*m bytes, the copies of the heavy hitters' k-grams */
+} rk_sketch;
+
+rk_sketch *rk_sketch_init(int k, int m, int width);
+void rk_sketch_free(rk_sketch *sk);
+
+void rk_topk_scan(rk_sketch *sk, const char *doc, int flags);
+int rk_topk_scan_file(rk_sketch *sk, const char *fname, int buf_size, int flags);
+void rk_topk_sort(rk_sketch *sk);
+long rk_sketch_error(const rk_sketch *sk);
+
+#endif
@@ -0,0 +1,68 @@
+/***********************************************************
+ File Name: rkstats.c
+ Description: hot-path statistics of rkgrep
+ **********************************************************/
+
+#include <stdio.h>
+#include <time.h>
+
+#include "rkstats.h"
+
+__thread rk_stats rk_stat;
+
+#ifndef RK_NO_STATS
+static const char *phase_names[RK_N_PHASES] = {"load", "index build", "query", "output"};
+#endif
+
+// rk_now_ns returns the current (monotonic) time in nanoseconds
+long long
+rk_now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// rk_stats_merge adds the counters of src to those of dst
+void
+rk_stats_merge(rk_stats *dst, const rk_stats *src)
+{
+	dst->bytes_scanned += src->bytes_scanned;
+	dst->windows_hashed += src->windows_hashed;
+	dst->hash_hits += src->hash_hits;
+	dst->verifications += src->verifications;
+	dst->true_matches += src->true_matches;
+	dst->false_hits += src->false_hits;
+	dst->filter_probes += src->filter_probes;
+	dst->filter_queries += src->filter_queries;
+	dst->filter_positives += src->filter_positives;
+	dst->filter_false_positives += src->filter_false_positives;
+	for (int i = 0; i < RK_N_PHASES; i++) {
+		dst->phase_ns[i] += src->phase_ns[i];
+	}
+}
+
+void
+rk_stats_print(FILE *f, const rk_stats *s)
+{
+#ifdef RK_NO_STATS
+	fprintf(f, "-- statistics are not available (compiled with RK_NO_STATS)\n");
+#else
+	fprintf(f, "-- bytes scanned          %ld\n", s->bytes_scanned);
+	fprintf(f, "-- windows hashed         %ld\n", s->windows_hashed);
+	fprintf(f, "-- hash hits              %ld\n", s->hash_hits);
+	fprintf(f, "-- verifications          %ld\n", s->verifications);
+	fprintf(f, "-- true matches           %ld\n", s->true_matches);
+	fprintf(f, "-- false hash hits        %ld\n", s->false_hits);
+	if (s->filter_queries > 0) {
+		long negatives = s->filter_queries - (s->filter_positives - s->filter_false_positives);
+		fprintf(f, "-- filter queries         %ld\n", s->filter_queries);
+		fprintf(f, "-- filter probes          %ld\n", s->filter_probes);
+		fprintf(f, "-- filter false positives %ld (rate %.4f%%)\n", s->filter_false_positives,
+			negatives > 0 ? 100.0 * s->filter_false_positives / negatives : 0.0);
+	}
+	for (int i = 0; i < RK_N_PHASES; i++) {
+		fprintf(f, "-- %-22s %.3f ms\n", phase_names[i], s->phase_ns[i] / 1e6);
+	}
+#endif
+}
@@ -0,0 +1,44 @@
+#ifndef __RKSTATS_H_
+#define __RKSTATS_H_
+
+#include <stdio.h>
+
+enum rk_phase {RK_PHASE_LOAD, RK_PHASE_INDEX, RK_PHASE_QUERY, RK_PHASE_OUTPUT, RK_N_PHASES};
+
+/* hot-path counters, kept per thread (see rk_stat) */
+typedef struct {
+	long bytes_scanned; /* bytes of documents scanned */
+	long windows_hashed; /* windows whose RK hash was computed */
+	long hash_hits; /* windows whose hash equals a pattern's hash */
+	long verifications; /* byte-by-byte comparisons of a window against a pattern */
+	long true_matches; /* verifications that found a match */
+	long false_hits; /* hash hits whose window differs from the pattern */
+	long filter_probes; /* bloom filter bits (or cuckoo filter buckets) examined */
+	long filter_queries; /* patterns looked up in a document filter */
+	long filter_positives; /* lookups answered "maybe present" */
+	long filter_false_positives; /* "maybe present" answers for patterns not in the document */
+	long long phase_ns[RK_N_PHASES]; /* time spent in each phase */
+} rk_stats;
+
+/* Every thread updates its own rk_stat without any locking or branching, so keeping the
+ * counters costs one add to a thread-local variable per event, and most events are
+ * counted in bulk (e.g. once per scanned range rather than once per window).
+ * Compile with -DRK_NO_STATS to remove the counters altogether.
+ */
+extern __thread rk_stats rk_stat;
+
+#ifdef RK_NO_STATS
+#define RK_STAT_ADD(field, n) do { } while (0)
+#define RK_PHASE_START(t) do { } while (0)
+#define RK_PHASE_END(t, phase) do { } while (0)
+#else
+#define RK_STAT_ADD(field, n) (rk_stat.field += (n))
+#define RK_PHASE_START(t) long long t = rk_now_ns()
+#define RK_PHASE_END(t, phase) (rk_stat.phase_ns[phase] += rk_now_ns() - (t))
+#endif
+
+long long rk_now_ns(void);
+void rk_stats_merge(rk_stats *dst, const rk_stats *src);
+void rk_stats_print(FILE *f, const rk_stats *s);
+
+#endif
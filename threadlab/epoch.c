@@ -0,0 +1,148 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <assert.h>
+#include <string.h>
+
+#include "epoch.h"
+
+/* ebr implements epoch-based memory reclamation (Fraser). A lock-free reader may still
+ * be looking at a node that another thread has just unlinked, so the node cannot be
+ * freed (or reused) right away. Instead, it is "retired" into the remover's limbo list.
+ * Readers announce themselves with ebr_enter/ebr_exit around every operation: they
+ * record the global epoch they entered at. The global epoch only advances from e to
+ * e+1 once every thread inside a critical section has entered at epoch e. An object
+ * retired while the global epoch is e can only be referenced by threads that entered at
+ * e or before. So once the global epoch is e+2, nothing retired in epoch e can still be
+ * referenced: a thread that sees a new global epoch g frees its own limbo list of epoch
+ * g-2, which is also the list of epoch g+1 it would use next.
+ * Entering costs one store and a fence on the thread's own cache line, so the read path
+ * stays lock-free and readers never write to shared lines.
+ * A thread without an index (see tid_get) uses the extra, shared slot, and holds a
+ * mutex from ebr_enter to ebr_exit so that no two threads use it at the same time.
+ */
+
+//the slots of a domain, one per thread index and the shared one
+#define N_SLOTS (EBR_MAX_THREADS + 1)
+
+#define ACTIVE 1UL
+
+//ebr_init initializes a reclamation domain whose objects are freed with free_fn(arg, obj)
+void
+ebr_init(ebr *d, void (*free_fn)(void *arg, void *obj), void *arg)
+{
+	d->epoch = 0;
+	d->free_fn = free_fn;
+	d->arg = arg;
+	if (posix_memalign((void **)&d->slots, CACHE_LINE, sizeof(ebr_slot)*N_SLOTS) != 0) {
+		d->slots = NULL;
+	}
+	assert(d->slots);
+	memset(d->slots, 0, sizeof(ebr_slot)*N_SLOTS);
+	pthread_mutex_init(&d->shared_m, NULL);
+}
+
+//my_slot returns the slot of the calling thread
+static inline ebr_slot *
+my_slot(ebr *d)
+{
+	int tid = tid_get();
+	return &d->slots[tid != TID_NONE ? tid : EBR_MAX_THREADS];
+}
+
+//free_limbo frees all objects of the limbo list l
+static void
+free_limbo(ebr *d, limbo *l)
+{
+	for (int i = 0; i < l->n; i++) {
+		d->free_fn(d->arg, l->objs[i]);
+	}
+	l->n = 0;
+}
+
+//ebr_destroy frees all retired objects; no other thread may use the domain
+void
+ebr_destroy(ebr *d)
+{
+	for (int i = 0; i < N_SLOTS; i++) {
+		for (int j = 0; j < 3; j++) {
+			free_limbo(d, &d->slots[i].retired[j]);
+			free(d->slots[i].retired[j].objs);
+		}
+	}
+	free(d->slots);
+	pthread_mutex_destroy(&d->shared_m);
+}
+
+//ebr_enter starts a critical section, during which the objects the thread reaches
+//will not be freed
+void
+ebr_enter(ebr *d)
+{
+	ebr_slot *s = my_slot(d);
+	if (s == &d->slots[EBR_MAX_THREADS]) {
+		pthread_mutex_lock(&d->shared_m);
+	}
+	unsigned long e = __atomic_load_n(&d->epoch, __ATOMIC_ACQUIRE);
+	while (1) {
+		__atomic_store_n(&s->state, (e << 1) | ACTIVE, __ATOMIC_RELAXED);
+		//the announcement must be visible before the thread reads any shared node
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+		//if the epoch moved on before others could see us, announce the new one instead
+		unsigned long now = __atomic_load_n(&d->epoch, __ATOMIC_ACQUIRE);
+		if (now == e) {
+			break;
+		}
+		e = now;
+	}
+	if (e != s->seen) {
+		s->seen = e;
+		free_limbo(d, &s->retired[(e + 1) % 3]);
+	}
+}
+
+//ebr_exit ends a critical section
+void
+ebr_exit(ebr *d)
+{
+	ebr_slot *s = my_slot(d);
+	__atomic_store_n(&s->state, 0, __ATOMIC_RELEASE);
+	if (s == &d->slots[EBR_MAX_THREADS]) {
+		pthread_mutex_unlock(&d->shared_m);
+	}
+}
+
+//try_advance moves the global epoch forward if every thread in a critical section
+//has entered at the current epoch
+static void
+try_advance(ebr *d)
+{
+	unsigned long e = __atomic_load_n(&d->epoch, __ATOMIC_ACQUIRE);
+	for (int i = 0; i < N_SLOTS; i++) {
+		unsigned long st = __atomic_load_n(&d->slots[i].state, __ATOMIC_ACQUIRE);
+		if ((st & ACTIVE) && (st >> 1) != e) {
+			return;
+		}
+	}
+	__atomic_compare_exchange_n(&d->epoch, &e, e + 1, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED);
+}
+
+//ebr_retire hands obj, which has been made unreachable, to the domain to be freed once
+//no thread can hold a reference to it. It must be called in a critical section.
+void
+ebr_retire(ebr *d, void *obj)
+{
+	ebr_slot *s = my_slot(d);
+	//readers that can still reach obj entered at the current epoch or before
+	unsigned long e = __atomic_load_n(&d->epoch, __ATOMIC_ACQUIRE);
+	limbo *l = &s->retired[e % 3];
+	if (l->n == l->cap) {
+		l->cap = l->cap ? 2*l->cap : 64;
+		l->objs = (void **)realloc(l->objs, sizeof(void *)*l->cap);
+		assert(l->objs);
+	}
+	l->objs[l->n++] = obj;
+	if (++s->n_retired >= EBR_ADVANCE_EVERY) {
+		s->n_retired = 0;
+		try_advance(d);
+	}
+}
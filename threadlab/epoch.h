@@ -0,0 +1,46 @@
+#ifndef EPOCH_H
+#define EPOCH_H
+
+#include <pthread.h>
+
+#include "rwlock.h"
+#include "tid.h"
+
+//number of threads that can use epoch-based reclamation at the same time without
+//waiting; the threads beyond it take turns on one more slot
+#define EBR_MAX_THREADS TID_MAX
+//a thread tries to advance the global epoch every EBR_ADVANCE_EVERY retired objects
+#define EBR_ADVANCE_EVERY 64
+
+//limbo is a list of retired objects waiting to be freed
+typedef struct {
+	void **objs;
+	int n;
+	int cap;
+} limbo;
+
+//ebr_slot is the state of one thread in an ebr domain, on its own cache lines
+typedef struct {
+	unsigned long state; //the epoch the thread entered at, shifted left by 1, | 1 while in a critical section
+	unsigned long seen; //the last global epoch the thread has seen
+	int n_retired; //objects retired since the last attempt to advance the epoch
+	limbo retired[3]; //objects retired in epochs e, by e % 3
+} __attribute__((aligned(CACHE_LINE))) ebr_slot;
+
+//ebr is a reclamation domain: the objects retired in it are handed to free_fn(arg, obj)
+//once no thread can still hold a reference to them
+typedef struct {
+	unsigned long epoch;
+	void (*free_fn)(void *arg, void *obj);
+	void *arg;
+	ebr_slot *slots; //EBR_MAX_THREADS slots, indexed by tid_get(), and the shared slot
+	pthread_mutex_t shared_m; //held by the thread in a critical section on the shared slot
+}ebr;
+
+void ebr_init(ebr *d, void (*free_fn)(void *arg, void *obj), void *arg);
+void ebr_destroy(ebr *d);
+void ebr_enter(ebr *d);
+void ebr_exit(ebr *d);
+void ebr_retire(ebr *d, void *obj);
+
+#endif
@@ -0,0 +1,135 @@
+#include <string.h>
+#include <stdint.h>
+#include <emmintrin.h>
+
+#include "hash.h"
+
+/* hash_bytes is a 64-bit string hash in the style of wyhash. Instead of one multiply and
+ * one modulo per character, it reads the key 8 bytes at a time and mixes two words at
+ * once with a 64x64->128-bit multiply, folding the two halves of the product together
+ * ("mum"). Keys of up to 16 bytes are read with (possibly overlapping) loads and need no
+ * loop at all.
+ * Long keys are first consumed in 64-byte stripes by an SSE2 loop in the style of XXH3:
+ * eight 64-bit accumulators each add the product of the two 32-bit halves of a data word
+ * xored with a secret, so the stripes are independent multiply-adds instead of a chain
+ * of dependent 128-bit multiplies.
+ */
+
+static const unsigned long long P0 = 0xa0761d6478bd642fULL;
+static const unsigned long long P1 = 0xe7037ed1a0b428dbULL;
+static const unsigned long long P2 = 0x8ebc6af09c88c6e3ULL;
+static const unsigned long long P3 = 0x589965cc75374cc3ULL;
+
+//number of stripes between two scrambles of the SIMD accumulators
+#define STRIPES_PER_BLOCK 16
+
+static inline unsigned long long
+mum(unsigned long long a, unsigned long long b)
+{
+	unsigned __int128 r = (unsigned __int128)a * b;
+	return (unsigned long long)r ^ (unsigned long long)(r >> 64);
+}
+
+static inline unsigned long long
+r8(const unsigned char *p)
+{
+	unsigned long long v;
+	memcpy(&v, p, 8);
+	return v;
+}
+
+static inline unsigned long long
+r4(const unsigned char *p)
+{
+	uint32_t v;
+	memcpy(&v, p, 4);
+	return v;
+}
+
+//hash_stripes hashes n 64-byte stripes starting at p with SSE2 and returns a 64-bit digest
+static unsigned long long
+hash_stripes(const unsigned char *p, int n)
+{
+	const __m128i secret[4] = {
+		_mm_set_epi64x(P1, P0), _mm_set_epi64x(P3, P2),
+		_mm_set_epi64x(P0, P3), _mm_set_epi64x(P2, P1),
+	};
+	const __m128i prime = _mm_set1_epi32(0x9e3779b1);
+	__m128i acc[4];
+	for (int j = 0; j < 4; j++) {
+		acc[j] = secret[j];
+	}
+	for (int i = 0; i < n; i++, p += 64) {
+		for (int j = 0; j < 4; j++) {
+			__m128i d = _mm_loadu_si128((const __m128i *)(p + 16*j));
+			__m128i k = _mm_xor_si128(d, secret[j]);
+			//the low half of each 64-bit lane times its high half
+			__m128i prod = _mm_mul_epu32(k, _mm_shuffle_epi32(k, _MM_SHUFFLE(2, 3, 0, 1)));
+			//adding the data too keeps one lane's bits from being lost if its product is 0
+			acc[j] = _mm_add_epi64(acc[j], _mm_add_epi64(prod, _mm_shuffle_epi32(d, _MM_SHUFFLE(1, 0, 3, 2))));
+		}
+		if ((i + 1) % STRIPES_PER_BLOCK == 0) {
+			//scramble, so that the high bits of the accumulators flow back into the low ones
+			for (int j = 0; j < 4; j++) {
+				__m128i a = _mm_xor_si128(_mm_xor_si128(acc[j], _mm_srli_epi64(acc[j], 47)), secret[j]);
+				__m128i lo = _mm_mul_epu32(a, prime);
+				__m128i hi = _mm_mul_epu32(_mm_srli_epi64(a, 32), prime);
+				acc[j] = _mm_add_epi64(lo, _mm_slli_epi64(hi, 32));
+			}
+		}
+	}
+	unsigned long long lanes[8];
+	for (int j = 0; j < 4; j++) {
+		_mm_storeu_si128((__m128i *)&lanes[2*j], acc[j]);
+	}
+	unsigned long long h = n * P2;
+	for (int j = 0; j < 8; j += 2) {
+		h += mum(lanes[j] ^ P0, lanes[j+1] ^ P1);
+	}
+	return h;
+}
+
+//hash_bytes returns the 64-bit hash of the len bytes at s
+unsigned long long
+hash_bytes(const char *s, int len)
+{
+	const unsigned char *p = (const unsigned char *)s;
+	unsigned long long seed = P0;
+	unsigned long long a, b;
+	if (len <= 16) {
+		if (len >= 4) {
+			int mid = (len >> 3) << 2;
+			a = (r4(p) << 32) | r4(p + mid);
+			b = (r4(p + len - 4) << 32) | r4(p + len - 4 - mid);
+		} else if (len > 0) {
+			a = ((unsigned long long)p[0] << 16) | ((unsigned long long)p[len >> 1] << 8) | p[len - 1];
+			b = 0;
+		} else {
+			a = b = 0;
+		}
+	} else {
+		int i = len;
+		if (len >= HASH_SIMD_MIN) {
+			int n = len / 64;
+			seed ^= hash_stripes(p, n);
+			p += 64*n;
+			i -= 64*n;
+		}
+		while (i > 16) {
+			seed = mum(r8(p) ^ P1, r8(p + 8) ^ seed);
+			p += 16;
+			i -= 16;
+		}
+		//the last 16 bytes of the key, which may overlap bytes hashed above
+		a = r8(p + i - 16);
+		b = r8(p + i - 8);
+	}
+	return mum(P1 ^ len, mum(a ^ P1, b ^ seed));
+}
+
+//hashcode returns the hashcode for a C string
+unsigned long long
+hashcode(const char *s)
+{
+	return hash_bytes(s, strlen(s));
+}
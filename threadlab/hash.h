@@ -0,0 +1,10 @@
+#ifndef HASH_H
+#define HASH_H
+
+//keys at least this long are hashed 64 bytes at a time with SSE2
+#define HASH_SIMD_MIN 128
+
+unsigned long long hash_bytes(const char *s, int len);
+unsigned long long hashcode(const char *s);
+
+#endif
@@ -4,173 +4,401 @@
 #include <string.h>
 #include <stdio.h>
 #include <pthread.h>
+#include <limits.h>
+#include <unistd.h>
 
 #include "htable.h"
+#include "hash.h"
 
 #define MAX_COLLISION 10
+//number of old buckets an insert migrates to the new array while a resize is in progress
+#define HT_MIGRATE_BATCH 8
 /* htable implements a hash table that handles collisions by chaining.
  * It contains an array, where each slot stores the head of a singly-linked list.
  * if the length of some chain is found to be longer than MAX_COLLISION after an insertion, the 
  * htable is resized by doubling the array size. 
+ *
+ * The htable is safe to use from many threads. Instead of one lock for the whole table,
+ * the buckets are split among HT_STRIPES reader-writer locks ("lock striping"): slot i is
+ * protected by stripe i % HT_STRIPES. Lookups hold their stripe in read mode and inserts
+ * in write mode, so operations on different stripes never wait for each other.
+ * The array size is a power of 2 and at least HT_STRIPES, so the stripe of a key only
+ * depends on its hashcode and stays the same when the array doubles.
+ *
+ * A resize does not rehash the whole table at once, which would stall the insert that
+ * triggered it. Instead, it only allocates the new array and keeps the old one next to
+ * it. From then on, every insert first moves HT_MIGRATE_BATCH buckets of its stripe from
+ * the old array to the new one, and new tuples always go to the new array. Until its
+ * bucket has been moved, a key may be in either array, so operations check both.
+ * If a chain of the new array gets too long before all stripes are done (with skewed
+ * keys, most stripes may get no inserts at all), the rest is moved at once and the
+ * array doubles again.
+ * Starting and finishing a resize take every stripe in write mode (always in
+ * increasing order, so that two threads cannot deadlock), but only to swap the arrays.
  */
-// calculate modulo addition
+//htable_init returns a new hash table that's been initialized
+void
+htable_init(htable *ht, int sz, int allow_resize) {
+	htable_init_backend(ht, sz, allow_resize, HT_STRIPED);
+}
+
+//htable_init_backend initializes a hash table that uses the given implementation
+void
+htable_init_backend(htable *ht, int sz, int allow_resize, enum ht_backend backend) {
+	ht->backend = backend;
+	switch (backend) {
+		case HT_SPLITLIST:
+			sl_init(&ht->sl, sz, allow_resize);
+			return;
+		case HT_SWISS:
+			sw_init(&ht->sw, sz);
+			return;
+		case HT_STRIPED:
+			break;
+	}
+	//initialize hash table with a power of 2 larger than sz entries
+	ht->size = HT_STRIPES;
+	while (ht->size <= sz) {
+		ht->size *= 2;
+	}
+	ht->store = (node **)calloc(ht->size, sizeof(node *));
+	ht->allow_resize = allow_resize;
+	assert(ht->store);
+	ht->old_store = NULL;
+	ht->old_size = 0;
+	ht->pending = 0;
+	pool_init(&ht->pool, sizeof(node));
+	if (posix_memalign((void **)&ht->stripes, CACHE_LINE, sizeof(stripe)*HT_STRIPES) != 0) {
+		ht->stripes = NULL;
+	}
+	assert(ht->stripes);
+	for (int i = 0; i < HT_STRIPES; i++) {
+		rwl_init(&ht->stripes[i].l);
+		ht->stripes[i].migrated = 0;
+	}
+}
+
+//htable_backend_name returns a printable name of an htable implementation
+const char *
+htable_backend_name(enum ht_backend backend) {
+	switch (backend) {
+		case HT_STRIPED:
+			return "striped";
+		case HT_SPLITLIST:
+			return "splitlist";
+		case HT_SWISS:
+			return "swiss";
+	}
+	return "unknown";
+}
+
+//htable_size returns the number of slots in the hash table
 int
-madd(int a, int b)
+htable_size(htable *ht) {
+	switch (ht->backend) {
+		case HT_SPLITLIST:
+			return sl_size(&ht->sl);
+		case HT_SWISS:
+			return sw_size(&ht->sw);
+		case HT_STRIPED:
+			break;
+	}
+	int sz = __atomic_load_n(&ht->size, __ATOMIC_RELAXED);
+	return sz;
+}
+
+//htable_destroy destroys the htable, freeing the memory associated with its fields
+void
+htable_destroy(htable *ht) {
+	switch (ht->backend) {
+		case HT_SPLITLIST:
+			sl_destroy(&ht->sl);
+			return;
+		case HT_SWISS:
+			sw_destroy(&ht->sw);
+			return;
+		case HT_STRIPED:
+			break;
+	}
+	// the nodes of all linked lists are freed with the slabs of the pool
+	pool_destroy(&ht->pool);
+	free(ht->store);
+	free(ht->old_store);
+	for (int i = 0; i < HT_STRIPES; i++) {
+		rwl_destroy(&ht->stripes[i].l);
+	}
+	free(ht->stripes);
+}
+
+//stripe_of returns the stripe that protects the slots of hashcode hcode
+static inline stripe *
+stripe_of(htable *ht, unsigned long long hcode)
 {
-	return ((a+b)>BIG_PRIME?(a+b-BIG_PRIME):(a+b));
+	return &ht->stripes[hcode & (HT_STRIPES - 1)];
 }
 
-// calculate modulo multiplication
-int
-mmul(int a, int b)
+//lock_all locks every stripe in write mode
+static void
+lock_all(htable *ht)
 {
-	return ((a*b) % BIG_PRIME);
+	for (int i = 0; i < HT_STRIPES; i++) {
+		rwl_wlock(&ht->stripes[i].l, NULL);
+	}
 }
 
+static void
+unlock_all(htable *ht)
+{
+	for (int i = HT_STRIPES - 1; i >= 0; i--) {
+		rwl_wunlock(&ht->stripes[i].l);
+	}
+}
 
-//hashcode returns the hashcode for a C string
-int
-hashcode(char *s) {
-	int p = 0;
-	int i = 0;
-	while (s[i] != '\0') {
-		p  = madd(mmul(p, 256), s[i]);
-		i++;
+//chain_find returns the node of key in the chain starting at curr, or NULL.
+//It stores the number of nodes it went through in *len.
+static node *
+chain_find(node *curr, unsigned long long hcode, char *key, int klen, int *len)
+{
+	int n = 0;
+	while (curr) {
+		if ((curr->hashcode == hcode) && htkey_eq(&curr->key, key, klen)) {
+			break;
+		}
+		curr = curr->next;
+		n++;
 	}
-	return p;
+	*len = n;
+	return curr;
 }
 
-//is_prime returns true if n is a prime number
-int
-is_prime(int n) {
-	if (n <= 3) {
-		return 1;
+//old_slot returns the slot of hashcode hcode in the old array, or NULL if stripe s
+//has already moved it to the new array (or there is no resize in progress).
+//The caller must hold stripe s.
+static node **
+old_slot(htable *ht, stripe *s, unsigned long long hcode)
+{
+	if (ht->old_store == NULL) {
+		return NULL;
 	}
-	if ((n % 2) == 0) {
-		return 0;
+	int slot = hcode & (ht->old_size - 1);
+	if (slot / HT_STRIPES < s->migrated) {
+		return NULL;
 	}
-	for (int i = 3; i < n; i+=2) {
-		if ((n % i) == 0) {
-			return 0;
+	return &ht->old_store[slot];
+}
+
+//old_chain returns the chain of hashcode hcode in the old array, or NULL (see old_slot)
+static node *
+old_chain(htable *ht, stripe *s, unsigned long long hcode)
+{
+	node **slot = old_slot(ht, s, hcode);
+	return slot ? *slot : NULL;
+}
+
+//chain_unlink removes the node of key from the chain at *slot and returns it, or NULL
+static node *
+chain_unlink(node **slot, unsigned long long hcode, char *key, int klen)
+{
+	for (node **pp = slot; pp && *pp; pp = &(*pp)->next) {
+		node *n = *pp;
+		if ((n->hashcode == hcode) && htkey_eq(&n->key, key, klen)) {
+			*pp = n->next;
+			return n;
 		}
 	}
-	return 1;
+	return NULL;
 }
 
-//get_prime returns a prime number larger than min
+//htable_migrate moves up to n buckets of stripe s, which the caller holds in write mode,
+//from the old array to the new one. Stripe s moves its buckets in increasing order.
+//It returns 1 if this was the last stripe left to migrate.
 static int
-get_prime(int min) {
-	int n = min;
-	while (1) {
-		if (is_prime(n)) {
-			return n;
+htable_migrate(htable *ht, stripe *s, int n)
+{
+	int per_stripe = ht->old_size / HT_STRIPES;
+	if (ht->old_store == NULL || s->migrated == per_stripe) {
+		return 0;
+	}
+	int first = s - ht->stripes;
+	for (int i = 0; i < n && s->migrated < per_stripe; i++) {
+		int slot = s->migrated*HT_STRIPES + first;
+		node *curr = ht->old_store[slot];
+		while (curr) {
+			node *n = curr;
+			curr = curr->next;
+			int new_slot = n->hashcode & (ht->size - 1);
+			n->next = ht->store[new_slot];
+			ht->store[new_slot] = n;
 		}
-		n++;	
+		ht->old_store[slot] = NULL;
+		s->migrated++;
 	}
+	if (s->migrated < per_stripe) {
+		return 0;
+	}
+	return __atomic_sub_fetch(&ht->pending, 1, __ATOMIC_ACQ_REL) == 0;
 }
 
-//htable_init returns a new hash table that's been initialized
-void
-htable_init(htable *ht, int sz, int allow_resize) {
-	//initialize hash table with a prime larger than sz entries
-	ht->size = get_prime(sz + 1);
-	ht->store = (node **)malloc(sizeof(node *)*ht->size);
-	ht->allow_resize = allow_resize;
-	assert(ht->store);
-	bzero(ht->store, sizeof(node *)*ht->size);
+//swap_arrays makes the array the old one and allocates a new array of new_size slots.
+//The caller must hold all stripes in write mode.
+static void
+swap_arrays(htable *ht, int new_size) {
+	ht->old_store = ht->store;
+	ht->old_size = ht->size;
+	ht->store = (node **)calloc(new_size, sizeof(node *));
+	assert(ht->store != NULL);
+	for (int i = 0; i < HT_STRIPES; i++) {
+		ht->stripes[i].migrated = 0;
+	}
+	ht->pending = HT_STRIPES;
+	__atomic_store_n(&ht->size, new_size, __ATOMIC_RELAXED);
 }
 
-//htable_size returns the number of slots in the hash table
-int
-htable_size(htable *ht) {
-	int sz = ht->size;
-	return sz;
+//migrate_all moves all remaining buckets of the old array at once and frees it.
+//The caller must hold all stripes in write mode.
+static void
+migrate_all(htable *ht) {
+	for (int i = 0; i < HT_STRIPES; i++) {
+		htable_migrate(ht, &ht->stripes[i], INT_MAX);
+	}
+	free(ht->old_store);
+	ht->old_store = NULL;
+	ht->old_size = 0;
 }
 
-void
-free_linked_list(node *n) {
-	if (n != NULL) {
-		free_linked_list(n->next);
-		free(n);
+//htable_resize starts to double the array size in order to control max number of
+//collsions, unless another thread has already done so since the size was old_size.
+//The buckets are moved later, by htable_migrate. A resize still in progress is finished
+//first: stripes that no insert or remove touches never migrate their buckets.
+static void
+htable_resize(htable *ht, int old_size) {
+	lock_all(ht);
+	if (ht->size == old_size) {
+		if (ht->old_store != NULL) {
+			migrate_all(ht);
+		}
+		swap_arrays(ht, 2*ht->size);
 	}
+	unlock_all(ht);
 }
 
-//htable_destroy destroys the htable, freeing the memory associated with its fields
+//htable_finish_resize frees the old array once all stripes have been migrated.
+//Another thread may have freed it (with migrate_all) and even started a new resize
+//since the caller migrated the last stripe, so this only frees a fully migrated array.
+static void
+htable_finish_resize(htable *ht) {
+	lock_all(ht);
+	if (ht->old_store != NULL && ht->pending == 0) {
+		free(ht->old_store);
+		ht->old_store = NULL;
+		ht->old_size = 0;
+	}
+	unlock_all(ht);
+}
+
+//htable_reserve makes room for n tuples in total, so that loading them does not
+//resize the htable again.
 void
-htable_destroy(htable *ht) {
-	// need to clean up every single linked list, and each of its nodes
-	for (int i = 0; i < ht->size; i++)
-		free_linked_list(ht->store[i]);
-	free(ht->store);
+htable_reserve(htable *ht, int n) {
+	switch (ht->backend) {
+		case HT_SPLITLIST:
+			sl_reserve(&ht->sl, n);
+			return;
+		case HT_SWISS:
+			sw_reserve(&ht->sw, n);
+			return;
+		case HT_STRIPED:
+			break;
+	}
+	int size = HT_STRIPES;
+	while (size < n) {
+		size *= 2;
+	}
+	lock_all(ht);
+	if (ht->old_store != NULL) {
+		migrate_all(ht);
+	}
+	if (ht->size < size) {
+		//the caller asked for it, so rehash at once rather than incrementally
+		swap_arrays(ht, size);
+		migrate_all(ht);
+	}
+	unlock_all(ht);
 }
 
-//htable_resize increases the size of an existing htable in order to control
-//max number of collsions.
-static void
-htable_resize(htable *ht) {
-	//double the array size
-	int new_size = get_prime(2*ht->size);
-	node **new_store = (node **)malloc(sizeof(node *)*new_size);
-	assert(new_store != NULL);
-	bzero(new_store, sizeof(node *)*new_size);
-
-	for (int i = 0; i < ht->size; i++) {
-		node *curr = ht->store[i];
-		while (curr) {
-			node *n = curr;
-			curr = curr->next;
-			int slot = n->hashcode % new_size;
-			//insert at the end of new table's slot
-			if (new_store[slot] != NULL) {
-				n->next = new_store[slot];
-			} else {
-				n->next = NULL;
-			}
-		       	new_store[slot] = n;
-		}
+//find_locked returns the node of key (of klen bytes) in stripe s, which the caller
+//holds, or NULL. It stores the length of key's chain in the new array in *collision.
+static node *
+find_locked(htable *ht, stripe *s, unsigned long long hcode, char *key, int klen, int *collision) {
+	node *n = chain_find(old_chain(ht, s, hcode), hcode, key, klen, collision);
+	if (n == NULL) {
+		n = chain_find(ht->store[hcode & (ht->size - 1)], hcode, key, klen, collision);
 	}
-	ht->size = new_size;
-	free(ht->store);
-	ht->store = new_store;
+	return n;
+}
 
+//link_locked links a new node for the key, val tuple, whose key is not in the htable,
+//into its stripe, which the caller holds in write mode.
+static void
+link_locked(htable *ht, unsigned long long hcode, char *key, int klen, void *val) {
+	//this key/value tuple corresponds to slot "slot"
+	int slot = hcode & (ht->size - 1);
+	//allocate a node to store key/value tuple
+	node *n = (node *)pool_alloc(&ht->pool);
+	n->hashcode = hcode;
+	htkey_set(&n->key, key, klen);
+	n->val = val;
+	n->next = ht->store[slot];
+	ht->store[slot] = n;
 }
 
+//insert_locked inserts the key (of klen bytes), val tuple into stripe s, which the
+//caller holds in write mode. It returns 1 if the key already exists and 0 otherwise,
+//and stores the length of the chain it went through in *collision.
+static int
+insert_locked(htable *ht, stripe *s, unsigned long long hcode, char *key, int klen, void *val,
+	      int *collision) {
+	if (find_locked(ht, s, hcode, key, klen, collision) != NULL) {
+		return 1; //found an existing key/value tupe with the same key
+	}
+	link_locked(ht, hcode, key, klen, val);
+	return 0;
+}
 
 //htable_insert inserts the key, val tuple into the htable. If the key already 
 //exists, it returns 1 indicating failure.  Otherwise, it inserts the new val and returns 0. 
 int
 htable_insert(htable *ht, char *key, void *val) {
 
-	int hcode = hashcode(key);	
-	//this key/value tuple corresponds to slot "slot"
-       	int slot = hcode % ht->size;
-	//traverse linked list at slot "slot", insert the new node at the end 
-	node *prev = NULL; 
-	node *curr = ht->store[slot];
-	int collision = 0;
-	while (curr) {
-		if ((curr->hashcode == hcode ) && (strcmp(curr->key, key) == 0)) {
-			return 1; //found an existing key/value tupe with the same key
-		}
-		prev = curr;
-		curr = curr->next;
-		collision++;
+	int klen = strlen(key);
+	unsigned long long hcode = hash_bytes(key, klen);
+	switch (ht->backend) {
+		case HT_SPLITLIST:
+			return sl_insert(&ht->sl, hcode, key, klen, val);
+		case HT_SWISS:
+			return sw_insert(&ht->sw, hcode, key, klen, val);
+		case HT_STRIPED:
+			break;
 	}
-
-	//allocate a node to store key/value tuple
-	node *n = (node *)malloc(sizeof(node));
-	n->hashcode = hcode;
-	n->key = key;
-	n->val = val;
-	n->next = NULL;
-
-	if (prev == NULL) {
-		ht->store[slot] = n;
-	}else {
-		prev->next = n;
+	stripe *s = stripe_of(ht, hcode);
+	//look for key in intent mode, which lets the lookups go on; only a new key needs
+	//write mode, and no other insert can come in between
+	rwl_ulock(&s->l, NULL);
+	int collision;
+	if (find_locked(ht, s, hcode, key, klen, &collision) != NULL) {
+		rwl_uunlock(&s->l);
+		return 1;
 	}
-	if (ht->allow_resize && collision >= MAX_COLLISION) {
-		htable_resize(ht);
+	rwl_upgrade(&s->l, NULL);
+	int finished = htable_migrate(ht, s, HT_MIGRATE_BATCH);
+	link_locked(ht, hcode, key, klen, val);
+
+	int size = ht->size;
+	rwl_wunlock(&s->l);
+	if (finished) {
+		htable_finish_resize(ht);
+	} else if (ht->allow_resize && collision >= MAX_COLLISION) {
+		htable_resize(ht, size);
 	}
 	return 0; //success
 }
@@ -179,14 +407,296 @@ htable_insert(htable *ht, char *key, void *val) {
 //otherwise it returns NULL.
 void *
 htable_lookup(htable *ht, char *key) {
-	int hcode = hashcode(key);
-       	int slot = hcode % ht->size;
-	node *curr = ht->store[slot];
-	while (curr) {
-		if ((curr->hashcode == hcode) && (strcmp(curr->key, key) == 0)) {
-			return curr->val;
+	int klen = strlen(key);
+	unsigned long long hcode = hash_bytes(key, klen);
+	switch (ht->backend) {
+		case HT_SPLITLIST:
+			return sl_lookup(&ht->sl, hcode, key, klen);
+		case HT_SWISS:
+			return sw_lookup(&ht->sw, hcode, key, klen);
+		case HT_STRIPED:
+			break;
+	}
+	stripe *s = stripe_of(ht, hcode);
+	rwl_rlock(&s->l, NULL);
+	int len;
+	node *n = find_locked(ht, s, hcode, key, klen, &len);
+	void *val = n ? n->val : NULL;
+	rwl_runlock(&s->l);
+	return val;
+}
+
+//htable_remove removes key from the htable. If the key does not exist, it returns 1
+//indicating failure. Otherwise, it returns 0.
+int
+htable_remove(htable *ht, char *key) {
+	int klen = strlen(key);
+	unsigned long long hcode = hash_bytes(key, klen);
+	switch (ht->backend) {
+		case HT_SPLITLIST:
+			return sl_remove(&ht->sl, hcode, key, klen);
+		case HT_SWISS:
+			return sw_remove(&ht->sw, hcode, key, klen);
+		case HT_STRIPED:
+			break;
+	}
+	stripe *s = stripe_of(ht, hcode);
+	rwl_wlock(&s->l, NULL);
+	int finished = htable_migrate(ht, s, HT_MIGRATE_BATCH);
+	node *n = chain_unlink(old_slot(ht, s, hcode), hcode, key, klen);
+	if (n == NULL) {
+		n = chain_unlink(&ht->store[hcode & (ht->size - 1)], hcode, key, klen);
+	}
+	//lookups hold the stripe in read mode, so none of them can be looking at n
+	if (n != NULL) {
+		pool_free(&ht->pool, n);
+	}
+	rwl_wunlock(&s->l);
+	if (finished) {
+		htable_finish_resize(ht);
+	}
+	return n == NULL;
+}
+
+//batch holds the state shared by the threads of htable_insert_batch
+typedef struct {
+	htable *ht;
+	char **keys;
+	void **vals;
+	int n;
+	unsigned long long *hcodes;
+	int *lens;
+	int *order; //the indexes of the keys, grouped by stripe
+	int *start; //the keys of stripe i are order[start[i]..start[i+1]-1]
+	int n_threads;
+	int dups; //keys that already existed
+	int max_collision;
+} batch;
+
+typedef struct {
+	batch *b;
+	int t;
+} batch_worker;
+
+//batch_hash computes the lengths and hashcodes of the t-th share of the keys
+static void *
+batch_hash(void *arg) {
+	batch_worker *w = (batch_worker *)arg;
+	batch *b = w->b;
+	int from = (long)b->n * w->t / b->n_threads;
+	int to = (long)b->n * (w->t + 1) / b->n_threads;
+	for (int i = from; i < to; i++) {
+		b->lens[i] = strlen(b->keys[i]);
+		b->hcodes[i] = hash_bytes(b->keys[i], b->lens[i]);
+	}
+	return NULL;
+}
+
+//batch_insert inserts the keys of the stripes t, t + n_threads, ..., locking each
+//stripe once for all of its keys
+static void *
+batch_insert(void *arg) {
+	batch_worker *w = (batch_worker *)arg;
+	batch *b = w->b;
+	htable *ht = b->ht;
+	int dups = 0, max_collision = 0;
+	for (int i = w->t; i < HT_STRIPES; i += b->n_threads) {
+		stripe *s = &ht->stripes[i];
+		rwl_wlock(&s->l, NULL);
+		for (int j = b->start[i]; j < b->start[i+1]; j++) {
+			int k = b->order[j];
+			int collision;
+			dups += insert_locked(ht, s, b->hcodes[k], b->keys[k], b->lens[k], b->vals[k], &collision);
+			if (collision > max_collision) {
+				max_collision = collision;
+			}
 		}
-		curr = curr->next;
+		rwl_wunlock(&s->l);
+	}
+	__atomic_add_fetch(&b->dups, dups, __ATOMIC_RELAXED);
+	int curr = __atomic_load_n(&b->max_collision, __ATOMIC_RELAXED);
+	while (curr < max_collision &&
+	       !__atomic_compare_exchange_n(&b->max_collision, &curr, max_collision, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
 	}
 	return NULL;
 }
+
+//run_batch runs fn on n_threads threads (on the calling thread if there is only one)
+static void
+run_batch(batch *b, void *(*fn)(void *)) {
+	batch_worker w[HT_BATCH_THREADS];
+	pthread_t threads[HT_BATCH_THREADS];
+	for (int t = 0; t < b->n_threads; t++) {
+		w[t].b = b;
+		w[t].t = t;
+	}
+	if (b->n_threads == 1) {
+		fn(&w[0]);
+		return;
+	}
+	int started = 0;
+	while (started < b->n_threads && pthread_create(&threads[started], NULL, fn, &w[started]) == 0) {
+		started++;
+	}
+	//the shares of the threads that could not be created are done by the calling thread
+	for (int t = started; t < b->n_threads; t++) {
+		fn(&w[t]);
+	}
+	for (int t = 0; t < started; t++) {
+		pthread_join(threads[t], NULL);
+	}
+}
+
+//htable_insert_batch inserts the n tuples keys[i], vals[i] and returns the number of
+//keys that already existed (and were not inserted).
+//With the striped backend, it reserves room for n tuples, hashes the keys in parallel
+//and groups them by stripe, then builds the chains of different stripes in parallel,
+//taking each stripe's lock once instead of once per key.
+int
+htable_insert_batch(htable *ht, char **keys, void **vals, int n) {
+	htable_reserve(ht, n);
+	if (ht->backend != HT_STRIPED) {
+		int dups = 0;
+		for (int i = 0; i < n; i++) {
+			dups += htable_insert(ht, keys[i], vals[i]);
+		}
+		return dups;
+	}
+
+	batch b;
+	b.ht = ht;
+	b.keys = keys;
+	b.vals = vals;
+	b.n = n;
+	b.hcodes = (unsigned long long *)malloc(sizeof(unsigned long long)*n);
+	b.lens = (int *)malloc(sizeof(int)*n);
+	b.order = (int *)malloc(sizeof(int)*n);
+	b.start = (int *)calloc(HT_STRIPES + 1, sizeof(int));
+	assert(b.hcodes && b.lens && b.order && b.start);
+	b.n_threads = 1;
+	if (n >= HT_BATCH_PARALLEL_MIN) {
+		b.n_threads = sysconf(_SC_NPROCESSORS_ONLN);
+		if (b.n_threads > HT_BATCH_THREADS) {
+			b.n_threads = HT_BATCH_THREADS;
+		}
+		if (b.n_threads < 1) {
+			b.n_threads = 1;
+		}
+	}
+	b.dups = 0;
+	b.max_collision = 0;
+
+	run_batch(&b, batch_hash);
+	//counting sort of the keys by stripe
+	for (int i = 0; i < n; i++) {
+		b.start[(b.hcodes[i] & (HT_STRIPES - 1)) + 1]++;
+	}
+	for (int i = 0; i < HT_STRIPES; i++) {
+		b.start[i+1] += b.start[i];
+	}
+	int *next = (int *)malloc(sizeof(int)*HT_STRIPES);
+	assert(next);
+	memcpy(next, b.start, sizeof(int)*HT_STRIPES);
+	for (int i = 0; i < n; i++) {
+		b.order[next[b.hcodes[i] & (HT_STRIPES - 1)]++] = i;
+	}
+	free(next);
+	run_batch(&b, batch_insert);
+
+	free(b.hcodes);
+	free(b.lens);
+	free(b.order);
+	free(b.start);
+	if (ht->allow_resize && b.max_collision >= MAX_COLLISION) {
+		htable_resize(ht, htable_size(ht));
+	}
+	return b.dups;
+}
+
+//lock_count returns the number of locks of ht
+static int
+lock_count(htable *ht)
+{
+	switch (ht->backend) {
+		case HT_SPLITLIST:
+			return 0;
+		case HT_SWISS:
+			return SW_SHARDS;
+		case HT_STRIPED:
+			break;
+	}
+	return HT_STRIPES;
+}
+
+static rwl *
+lock_at(htable *ht, int i)
+{
+	switch (ht->backend) {
+		case HT_SWISS:
+			return &ht->sw.shards[i].l;
+		default:
+			break;
+	}
+	return &ht->stripes[i].l;
+}
+
+//htable_lock_stats_enable makes all locks of ht keep statistics. It must be called
+//before other threads use ht.
+void
+htable_lock_stats_enable(htable *ht)
+{
+	for (int i = 0; i < lock_count(ht); i++) {
+		rwl_stats_enable(lock_at(ht, i));
+	}
+}
+
+//htable_lock_stats_print prints the statistics of all locks of ht together, then those
+//of the HT_HOT_LOCKS locks with the most contended acquisitions
+void
+htable_lock_stats_print(htable *ht)
+{
+	int n = lock_count(ht);
+	if (n == 0) {
+		printf("The %s htable has no locks\n", htable_backend_name(ht->backend));
+		return;
+	}
+	const char *what = (ht->backend == HT_SWISS) ? "shard" : "stripe";
+	rwl_stats total;
+	memset(&total, 0, sizeof(total));
+	int hot[HT_HOT_LOCKS];
+	unsigned long hot_contended[HT_HOT_LOCKS];
+	for (int j = 0; j < HT_HOT_LOCKS; j++) {
+		hot[j] = -1;
+		hot_contended[j] = 0;
+	}
+	for (int i = 0; i < n; i++) {
+		rwl_stats st;
+		memset(&st, 0, sizeof(st));
+		rwl_stats_get(lock_at(ht, i), &st);
+		rwl_stats_get(lock_at(ht, i), &total);
+		unsigned long c = 0;
+		for (int k = 0; k < RWL_NKINDS; k++) {
+			c += st.contended[k];
+		}
+		//keep hot sorted by decreasing contention
+		for (int j = 0; j < HT_HOT_LOCKS; j++) {
+			if (c > hot_contended[j]) {
+				memmove(&hot[j + 1], &hot[j], sizeof(int)*(HT_HOT_LOCKS - j - 1));
+				memmove(&hot_contended[j + 1], &hot_contended[j], sizeof(unsigned long)*(HT_HOT_LOCKS - j - 1));
+				hot[j] = i;
+				hot_contended[j] = c;
+				break;
+			}
+		}
+	}
+	char name[64];
+	snprintf(name, sizeof(name), "All %d %ss of the %s htable", n, what, htable_backend_name(ht->backend));
+	rwl_stats_print(name, &total);
+	for (int j = 0; j < HT_HOT_LOCKS && hot[j] >= 0; j++) {
+		rwl_stats st;
+		memset(&st, 0, sizeof(st));
+		rwl_stats_get(lock_at(ht, hot[j]), &st);
+		snprintf(name, sizeof(name), "Hot %s %d", what, hot[j]);
+		rwl_stats_print(name, &st);
+	}
+}
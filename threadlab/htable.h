@@ -2,27 +2,68 @@
 #define HTABLE_H
 
 #include "rwlock.h"
+#include "nodepool.h"
+#include "htkey.h"
+#include "splitlist.h"
+#include "swisstable.h"
 
 #define BIG_PRIME 1560007
+//number of rwl stripes protecting the buckets, bucket i is protected by stripe i % HT_STRIPES.
+//It must be a power of 2.
+#define HT_STRIPES 256
+//htable_insert_batch uses up to HT_BATCH_THREADS threads for at least HT_BATCH_PARALLEL_MIN keys
+#define HT_BATCH_THREADS 16
+#define HT_BATCH_PARALLEL_MIN 4096
+//htable_lock_stats_print details the HT_HOT_LOCKS most contended locks
+#define HT_HOT_LOCKS 3
 
 //node is the type of a linked list node type. Each hash table entry corresponds to a linked list containing key/value tuples that are hashed to the same slot.
 typedef struct node {
-	int hashcode;
-	char *key;
+	unsigned long long hashcode; //the full 64-bit hash of key
+	htkey key;
 	void *val;
 	struct node *next;
 }node;
 
+//stripe is one lock of the htable, padded to its own cache lines so that
+//threads working on neighbouring stripes do not contend on the same line
 typedef struct {
+	rwl l;
+	int migrated; //buckets of this stripe already moved from old_store to store
+} __attribute__((aligned(CACHE_LINE))) stripe;
+
+//the implementations an htable can use, chosen with htable_init_backend
+enum ht_backend {
+	HT_STRIPED, //chained buckets protected by striped rwl locks (the default)
+	HT_SPLITLIST, //lock-free split-ordered list
+	HT_SWISS //open addressing with SIMD-probed control bytes
+};
+
+typedef struct {
+	enum ht_backend backend;
 	int allow_resize;
 	node **store; //to contain an array of linked list heads
-	int size; //size of the array
+	int size; //size of the array, a power of 2
+	node **old_store; //the array being migrated to store during a resize, or NULL
+	int old_size;
+	int pending; //number of stripes that have not finished migrating old_store
+	nodepool pool; //where the nodes are allocated
+	stripe *stripes; //HT_STRIPES locks, each protecting every HT_STRIPES-th bucket
+	splitlist sl; //used instead of the fields above by HT_SPLITLIST
+	swisstable sw; //used instead of the fields above by HT_SWISS
 }htable;
 
 void htable_init(htable *ht, int sz, int allow_resize);
+void htable_init_backend(htable *ht, int sz, int allow_resize, enum ht_backend backend);
+const char *htable_backend_name(enum ht_backend backend);
 void htable_destroy(htable *ht);
 int htable_size(htable *ht);
 int htable_insert(htable *ht, char *key, void *val);
+void htable_reserve(htable *ht, int n);
+int htable_insert_batch(htable *ht, char **keys, void **vals, int n);
 void *htable_lookup(htable *ht, char *key);
+int htable_remove(htable *ht, char *key);
+void htable_lock_stats_enable(htable *ht);
+void htable_lock_stats_print(htable *ht);
 
 #endif
@@ -0,0 +1,41 @@
+#ifndef HTKEY_H
+#define HTKEY_H
+
+#include <string.h>
+
+//keys of up to HT_INLINE_KEY bytes are copied into the node itself
+#define HT_INLINE_KEY 24
+
+//htkey is the key of an htable tuple: short keys are stored inline, so that comparing
+//them does not touch another cache line, and long keys point to the caller's string.
+typedef struct {
+	union {
+		char inl[HT_INLINE_KEY]; //the key itself, if len <= HT_INLINE_KEY
+		const char *ptr; //the caller's key otherwise
+	};
+	int len;
+} htkey;
+
+static inline void
+htkey_set(htkey *k, const char *s, int len)
+{
+	k->len = len;
+	if (len <= HT_INLINE_KEY) {
+		memcpy(k->inl, s, len);
+	} else {
+		k->ptr = s;
+	}
+}
+
+//htkey_eq returns true if k is the len bytes at s. Keys of different lengths are told
+//apart without reading any key byte.
+static inline int
+htkey_eq(const htkey *k, const char *s, int len)
+{
+	if (k->len != len) {
+		return 0;
+	}
+	return memcmp(len <= HT_INLINE_KEY ? k->inl : k->ptr, s, len) == 0;
+}
+
+#endif
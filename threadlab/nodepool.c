@@ -0,0 +1,119 @@
+#include <stdlib.h>
+#include <assert.h>
+#include <stdint.h>
+
+#include "nodepool.h"
+
+/* nodepool replaces one malloc per htable node, which goes through the allocator's
+ * shared state on every insert, with a per-thread bump allocator: each thread carves
+ * nodes out of its own POOL_SLAB_SIZE slab and only synchronizes with other threads
+ * (with one compare-and-swap) when it needs a new slab.
+ * Freed nodes go to a lock-free free list (a Treiber stack) that all threads allocate
+ * from first. To avoid the ABA problem on pop, the list head carries a counter in its
+ * top 16 bits (user-space x86-64 pointers only use the low 48 bits).
+ * The pool keeps a list of all of its slabs, so destroying it frees whole slabs instead
+ * of walking every node.
+ */
+
+#define SLAB_HEADER 16 //room for the slab list link, keeping nodes 16-byte aligned
+#define PTR_MASK ((1ULL << 48) - 1)
+
+//pool_cache is the slab a thread is currently carving nodes from for the pool with id id
+typedef struct {
+	int id;
+	char *next;
+	char *end;
+} pool_cache;
+
+static __thread pool_cache caches[POOL_CACHE_WAYS];
+static __thread int cache_victim;
+static int next_pool_id = 1;
+
+//pool_init initializes a pool of nodes of obj_size bytes
+void
+pool_init(nodepool *p, int obj_size)
+{
+	p->id = __atomic_fetch_add(&next_pool_id, 1, __ATOMIC_RELAXED);
+	p->obj_size = (obj_size + 7) & ~7; //large enough to hold the free list link
+	p->per_slab = (POOL_SLAB_SIZE - SLAB_HEADER) / p->obj_size;
+	assert(p->per_slab > 0);
+	p->slabs = NULL;
+	p->free_list = 0;
+}
+
+//pool_destroy frees all nodes of the pool at once; no other thread may use it
+void
+pool_destroy(nodepool *p)
+{
+	void *slab = p->slabs;
+	while (slab) {
+		void *next = *(void **)slab;
+		free(slab);
+		slab = next;
+	}
+	p->slabs = NULL;
+	p->free_list = 0;
+}
+
+//new_slab allocates a slab for p, links it into p's slab list and makes it the
+//calling thread's cache c
+static void
+new_slab(nodepool *p, pool_cache *c)
+{
+	char *slab = (char *)malloc(POOL_SLAB_SIZE);
+	assert(slab);
+	void *head = __atomic_load_n(&p->slabs, __ATOMIC_RELAXED);
+	do {
+		*(void **)slab = head;
+	} while (!__atomic_compare_exchange_n(&p->slabs, &head, slab, 0, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+	c->id = p->id;
+	c->next = slab + SLAB_HEADER;
+	c->end = c->next + p->per_slab*p->obj_size;
+}
+
+//pool_alloc returns an uninitialized node
+void *
+pool_alloc(nodepool *p)
+{
+	unsigned long long head = __atomic_load_n(&p->free_list, __ATOMIC_ACQUIRE);
+	while (head & PTR_MASK) {
+		void *obj = (void *)(uintptr_t)(head & PTR_MASK);
+		//nodes are never returned to malloc before pool_destroy, so reading obj is safe
+		//even if another thread has popped it in the meantime; the tag then makes the CAS fail
+		unsigned long long next = (uintptr_t)*(void **)obj | ((head & ~PTR_MASK) + (1ULL << 48));
+		if (__atomic_compare_exchange_n(&p->free_list, &head, next, 0, __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE)) {
+			return obj;
+		}
+	}
+
+	pool_cache *c = NULL;
+	for (int i = 0; i < POOL_CACHE_WAYS; i++) {
+		if (caches[i].id == p->id) {
+			c = &caches[i];
+			break;
+		}
+	}
+	if (c == NULL) {
+		//give up the rest of the slab that has been cached the longest
+		c = &caches[cache_victim];
+		cache_victim = (cache_victim + 1) % POOL_CACHE_WAYS;
+		new_slab(p, c);
+	} else if (c->next == c->end) {
+		new_slab(p, c);
+	}
+	void *obj = c->next;
+	c->next += p->obj_size;
+	return obj;
+}
+
+//pool_free returns a node to the pool's free list
+void
+pool_free(nodepool *p, void *obj)
+{
+	unsigned long long head = __atomic_load_n(&p->free_list, __ATOMIC_RELAXED);
+	unsigned long long n;
+	do {
+		*(void **)obj = (void *)(uintptr_t)(head & PTR_MASK);
+		n = (uintptr_t)obj | ((head & ~PTR_MASK) + (1ULL << 48));
+	} while (!__atomic_compare_exchange_n(&p->free_list, &head, n, 0, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
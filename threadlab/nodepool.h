@@ -0,0 +1,23 @@
+#ifndef NODEPOOL_H
+#define NODEPOOL_H
+
+//size of one slab that nodes are carved from
+#define POOL_SLAB_SIZE (1 << 16)
+//number of pools a thread can allocate from without giving up the rest of a slab
+#define POOL_CACHE_WAYS 4
+
+//nodepool allocates fixed-size nodes for one htable
+typedef struct {
+	int id; //identifies the pool in the per-thread caches
+	int obj_size;
+	int per_slab; //number of nodes in a slab
+	void *slabs; //all slabs of the pool, linked through their first word
+	unsigned long long free_list; //freed nodes, a pointer tagged with a counter in its top 16 bits
+}nodepool;
+
+void pool_init(nodepool *p, int obj_size);
+void pool_destroy(nodepool *p);
+void *pool_alloc(nodepool *p);
+void pool_free(nodepool *p, void *obj);
+
+#endif
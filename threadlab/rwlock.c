@@ -1,9 +1,18 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
 #include <time.h>
 #include <errno.h>
-#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <x86intrin.h>
 #include <assert.h>
 #include "rwlock.h"
+#include "tid.h"
 
 /* rwl implements a reader-writer lock.
  * A reader-write lock can be acquired in two different modes, 
@@ -12,36 +21,502 @@
  * Many threads can grab the lock in the "read" mode.  
  * By contrast, if one thread has acquired the lock in "write" mode, no other 
  * threads can acquire the lock in either "read" or "write" mode.
+ * A third, "intent" (or "upgradable read") mode lets a thread read alongside the readers,
+ * but excludes the writers and the other intent holders; so its holder can turn it into
+ * write mode (rwl_upgrade) without releasing it, and without the deadlock two readers
+ * upgrading at the same time would run into. A writer can turn its lock into read mode
+ * with rwl_downgrade.
+ *
+ * The whole lock is one 32-bit word, state: the number of active readers (10 bits, an
+ * intent holder counts as one), of waiting readers and of waiting writers (9 bits each),
+ * and bits for an active writer, an intent holder and an intent holder waiting to upgrade.
+ * Uncontended, locking and unlocking are one atomic instruction each. The counts never
+ * fill their fields: the threads that would overflow them yield until there is room
+ * (see can_read and lock_mode), so the number of threads is not limited.
+ * A thread that cannot get the lock first spins for it, with exponential backoff, about
+ * twice as long as it took the last threads that got the lock by spinning (at most
+ * RWL_MAX_SPIN times, and not at all on a uniprocessor). If it still cannot get it, it
+ * counts itself as waiting and sleeps on state with a futex. Readers, intent waiters,
+ * writers and upgraders sleep with different futex bitsets, so that an unlock wakes
+ * exactly whom it should: one writer if any is waiting (writers have priority), otherwise
+ * all waiting readers. FUTEX_WAIT_BITSET takes an absolute CLOCK_REALTIME timeout, which
+ * is what "expire" is.
+ *
+ * Going through state for every read lock makes all readers write to the lock's cache
+ * line, which stops read-mostly workloads from scaling. So, as in BRAVO (Dice and Kogan),
+ * while a lock is "read-biased" (rbias), a reader checks in by storing the lock's address
+ * into one of its own reader slots, a cache line that no other thread writes to, and
+ * never touches state. A writer first revokes the bias, which sends new readers to state,
+ * where they queue behind the writer as before; once it has the lock, it waits for the
+ * slots that still hold the lock to empty. Each lock maps to one slot per thread, so a
+ * writer only reads TID_MAX words. A thread without an index (see tid_get) has no slots
+ * and always goes through state.
+ * Revoking costs the writer that scan, so after a revocation the bias is only set again
+ * (by a reader that gets the lock through state) once RWL_INHIBIT_MULT times the time it
+ * took has passed: write-heavy locks mostly stay unbiased and pay almost nothing for it.
  */
 
-//helper function
+#define RWL_READER 1u
+#define RWL_WAIT_READER (1u << 10)
+#define RWL_WAIT_WRITER (1u << 19)
+#define RWL_UPGRADING (1u << 28) //the intent holder waits to upgrade
+#define RWL_INTENT_HELD (1u << 29) //a thread holds the lock in intent mode
+#define RWL_DRAIN (1u << 30) //reader slots may hold the lock, the next writer must drain them
+#define RWL_WRITER (1u << 31)
+//the largest values of the count of active readers and of the counts of waiting readers
+//and waiting writers in state; see can_read and lock_mode for how they are never exceeded
+#define RWL_MAX_READERS 0x3ff
+#define RWL_MAX_WAITING 0x1ff
+
+//the futex bitsets readers, intent waiters, writers and upgraders sleep with
+#define WAKE_READERS 1
+#define WAKE_INTENT 2
+#define WAKE_WRITERS 4
+#define WAKE_UPGRADER 8
+
+//reader_slots[t] are the reader slots of thread t, each holds a lock that t holds in read mode
+static rwl *reader_slots[TID_MAX][RWL_READER_SLOTS] __attribute__((aligned(CACHE_LINE)));
+//my_slots are the reader slots of the calling thread, NULL until it first checks in
+static __thread rwl **my_slots;
+
+//thread_slots returns the reader slots of the calling thread, or NULL if it has no index
+static inline rwl **
+thread_slots()
+{
+	if (my_slots == NULL) {
+		int tid = tid_get();
+		if (tid != TID_NONE) {
+			my_slots = reader_slots[tid];
+		}
+	}
+	return my_slots;
+}
+
+static inline int
+slot_of(rwl *l)
+{
+	//locks are aligned to cache lines, so the low bits of their address are all 0
+	return ((uintptr_t)l / CACHE_LINE) % RWL_READER_SLOTS;
+}
+
+//now returns the time stamp counter, much cheaper to read than clock_gettime
+static inline long long
+now()
+{
+	return __rdtsc();
+}
+
+//expired returns true if the absolute time expire has passed
 static inline int
-cond_timedwait(pthread_cond_t *c, pthread_mutex_t *m, const struct timespec *expire)
+expired(const struct timespec *expire)
+{
+	struct timespec t;
+	clock_gettime(CLOCK_REALTIME, &t);
+	return t.tv_sec > expire->tv_sec || (t.tv_sec == expire->tv_sec && t.tv_nsec >= expire->tv_nsec);
+}
+
+//drain_readers waits until no reader slot holds l. It returns ETIMEDOUT if some still
+//does at absolute time "expire", and 0 otherwise.
+static int
+drain_readers(rwl *l, const struct timespec *expire)
+{
+	int s = slot_of(l);
+	for (int t = 0; t < TID_MAX; t++) {
+		while (__atomic_load_n(&reader_slots[t][s], __ATOMIC_SEQ_CST) == l) {
+			if (expire != NULL && expired(expire)) {
+				return ETIMEDOUT;
+			}
+			sched_yield();
+		}
+	}
+	return 0;
+}
+
+//revoke_bias turns off the reader bias of l, which the caller holds in write mode,
+//and waits for the readers that checked in through their slots to leave, like drain_readers
+static int
+revoke_bias(rwl *l, const struct timespec *expire)
 {
-	int r; 
-	if (expire != NULL)  {
-		r = pthread_cond_timedwait(c, m, expire);
-	} else
-		r = pthread_cond_wait(c, m);
-	assert(r == 0 || r == ETIMEDOUT);
-       	return r;
+	__atomic_store_n(&l->rbias, 0, __ATOMIC_SEQ_CST);
+	long long start = now();
+	int r = drain_readers(l, expire);
+	long long end = now();
+	l->inhibit_until = end + RWL_INHIBIT_MULT*(end - start);
+	return r;
+}
+
+static inline int
+active_readers(unsigned int s)
+{
+	return s & RWL_MAX_READERS;
+}
+
+static inline int
+waiting_readers(unsigned int s)
+{
+	return (s >> 10) & RWL_MAX_WAITING;
+}
+
+static inline int
+waiting_writers(unsigned int s)
+{
+	return (s >> 19) & RWL_MAX_WAITING;
+}
+
+//can_read returns true if a reader may take a lock in state s: writers have priority,
+//so a reader also waits behind writers (and an upgrader) that are only waiting. It also
+//waits while RWL_MAX_READERS-1 readers hold the lock through state, for one of them to
+//leave (the count never reaches RWL_MAX_READERS, which is what an extra unlock leaves)
+static int
+can_read(unsigned int s)
+{
+	return !(s & (RWL_WRITER | RWL_UPGRADING)) && waiting_writers(s) == 0 &&
+		active_readers(s) < RWL_MAX_READERS - 1;
+}
+
+static int
+can_intent(unsigned int s)
+{
+	return can_read(s) && !(s & RWL_INTENT_HELD);
+}
+
+static int
+can_write(unsigned int s)
+{
+	return !(s & RWL_WRITER) && active_readers(s) == 0;
+}
+
+static unsigned int
+take_read(unsigned int s)
+{
+	return s + RWL_READER;
+}
+
+static unsigned int
+take_intent(unsigned int s)
+{
+	return s + RWL_READER + RWL_INTENT_HELD;
+}
+
+static unsigned int
+take_write(unsigned int s)
+{
+	//a writer that must drain the reader slots counts as waiting until it is done
+	return s + RWL_WRITER + ((s & RWL_DRAIN) ? RWL_WAIT_WRITER : 0);
+}
+
+//rwl_mode describes how a thread gets the lock in one of its modes
+typedef struct {
+	int (*can)(unsigned int s); //whether the mode is free in state s
+	unsigned int (*take)(unsigned int s); //the state once a thread (not counted as waiting) has taken it
+	unsigned int wait; //what a waiting thread adds to the state
+	int (*waiting)(unsigned int s); //how many threads wait in state s for the mode
+	int bits; //the futex bitset it sleeps with
+} rwl_mode;
+
+static const rwl_mode read_mode = {can_read, take_read, RWL_WAIT_READER, waiting_readers, WAKE_READERS};
+//intent waiters count as waiting readers: like readers, they are held back by writers
+static const rwl_mode intent_mode = {can_intent, take_intent, RWL_WAIT_READER, waiting_readers, WAKE_INTENT};
+static const rwl_mode write_mode = {can_write, take_write, RWL_WAIT_WRITER, waiting_writers, WAKE_WRITERS};
+
+//futex_wait sleeps until a wakeup for bits, if state is still s. It returns ETIMEDOUT
+//if the absolute time "expire" passes first, and 0 otherwise.
+static int
+futex_wait(rwl *l, unsigned int s, const struct timespec *expire, int bits)
+{
+	struct timespec t;
+	if (expire != NULL && expire->tv_nsec >= 1000000000L) {
+		t.tv_sec = expire->tv_sec + expire->tv_nsec/1000000000L;
+		t.tv_nsec = expire->tv_nsec % 1000000000L;
+		expire = &t;
+	}
+	if (syscall(SYS_futex, &l->state, FUTEX_WAIT_BITSET | FUTEX_PRIVATE_FLAG | FUTEX_CLOCK_REALTIME,
+		    s, expire, NULL, bits) < 0 && errno == ETIMEDOUT) {
+		return ETIMEDOUT;
+	}
+	return 0;
+}
+
+static inline void
+futex_wake(rwl *l, int n, int bits)
+{
+	syscall(SYS_futex, &l->state, FUTEX_WAKE_BITSET | FUTEX_PRIVATE_FLAG, n, NULL, NULL, bits);
+}
+
+//wake_readers wakes all waiting readers and intent waiters if they may go on in state s
+static void
+wake_readers(rwl *l, unsigned int s)
+{
+	if (waiting_readers(s) > 0 && can_read(s)) {
+		futex_wake(l, INT_MAX, WAKE_READERS | WAKE_INTENT);
+	}
+}
+
+//wake_waiters wakes whoever can use l now that a writer has left it (or given up
+//waiting for it), state being s: one writer if any is waiting, otherwise all readers
+static void
+wake_waiters(rwl *l, unsigned int s)
+{
+	if (s & RWL_WRITER) {
+		return; //another writer got in first, it will wake them when it leaves
+	}
+	if (waiting_writers(s) > 0) {
+		if (active_readers(s) == 0) {
+			futex_wake(l, 1, WAKE_WRITERS);
+		}
+	} else {
+		wake_readers(l, s);
+	}
+}
+
+//wake_after_read wakes whoever waits for the reader that just left, state being s
+static inline void
+wake_after_read(rwl *l, unsigned int s)
+{
+	if (active_readers(s) == 0 && waiting_writers(s) > 0) {
+		futex_wake(l, 1, WAKE_WRITERS);
+	} else if (active_readers(s) == 1 && (s & RWL_UPGRADING)) {
+		futex_wake(l, 1, WAKE_UPGRADER); //only the upgrader itself is left
+	} else if (active_readers(s) == RWL_MAX_READERS - 2) {
+		wake_readers(l, s); //they may have waited for the readers to make room
+	}
+}
+
+static int ncpus;
+
+//spin_limit returns how many times to spin for l before sleeping
+static inline int
+spin_limit(rwl *l)
+{
+	if (ncpus == 0) {
+		ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+	}
+	if (ncpus < 2) {
+		return 0; //the holder cannot leave while we spin
+	}
+	int n = 2*__atomic_load_n(&l->spins, __ATOMIC_RELAXED) + 10;
+	return n < RWL_MAX_SPIN ? n : RWL_MAX_SPIN;
+}
+
+//spin_update folds the n spins a thread just did for l into l->spins
+static inline void
+spin_update(rwl *l, int n)
+{
+	int spins = __atomic_load_n(&l->spins, __ATOMIC_RELAXED);
+	__atomic_store_n(&l->spins, spins + (n - spins)/8, __ATOMIC_RELAXED);
+}
+
+static inline void
+backoff(int *pauses)
+{
+	for (int i = 0; i < *pauses; i++) {
+		_mm_pause();
+	}
+	if (*pauses < 16) {
+		*pauses *= 2;
+	}
+}
+
+static inline long long
+clock_ns()
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec*1000000000LL + t.tv_nsec;
+}
+
+//hist_bucket returns the log2 histogram bucket of ns
+static inline int
+hist_bucket(long long ns)
+{
+	int b = 63 - __builtin_clzll(ns | 1);
+	return b < RWL_HIST_BUCKETS ? b : RWL_HIST_BUCKETS - 1;
+}
+
+//thread_stats returns the statistics of the calling thread for l, or NULL if the thread
+//has no index (its operations are not counted then)
+static inline rwl_stats *
+thread_stats(rwl *l)
+{
+	int tid = tid_get();
+	return tid != TID_NONE ? &l->stats[tid] : NULL;
+}
+
+//stats_waiting records that state s has the current thread waiting for l
+static void
+stats_waiting(rwl *l, unsigned int s)
+{
+	rwl_stats *st = thread_stats(l);
+	if (st == NULL) {
+		return;
+	}
+	int writers = waiting_writers(s) + ((s & RWL_UPGRADING) != 0);
+	if (waiting_readers(s) > st->max_waiting_readers) {
+		st->max_waiting_readers = waiting_readers(s);
+	}
+	if (writers > st->max_waiting_writers) {
+		st->max_waiting_writers = writers;
+	}
+}
+
+//stats_locked records an attempt, started at time t0, to take l in mode kind, which
+//returned r
+static void
+stats_locked(rwl *l, int kind, int r, long long t0, int contended)
+{
+	rwl_stats *st = thread_stats(l);
+	if (st == NULL) {
+		return;
+	}
+	if (r == ETIMEDOUT) {
+		st->timeouts[kind]++;
+		return;
+	}
+	long long t = clock_ns();
+	st->acquired[kind]++;
+	st->contended[kind] += contended;
+	st->wait_hist[hist_bucket(t - t0)]++;
+	st->held_since[kind] = t;
+}
+
+//stats_unlocked records that the current thread leaves l, held in mode kind
+static void
+stats_unlocked(rwl *l, int kind)
+{
+	rwl_stats *st = thread_stats(l);
+	if (st == NULL) {
+		return;
+	}
+	st->hold_hist[hist_bucket(clock_ns() - st->held_since[kind])]++;
+}
+
+//lock_mode takes l in mode m, spinning and then sleeping until absolute time "expire".
+//It returns 0 and stores in *ps the state it took the lock in, or, once expire has
+//passed, ETIMEDOUT and the state after it stopped waiting. It sets *contended if the
+//lock was not free at first.
+static int
+lock_mode(rwl *l, const rwl_mode *m, const struct timespec *expire, unsigned int *ps, int *contended)
+{
+	unsigned int s = __atomic_load_n(&l->state, __ATOMIC_RELAXED);
+	int limit = spin_limit(l);
+	int pauses = 1;
+	for (int i = 0; ; i++) {
+		if (m->can(s)) {
+			if (__atomic_compare_exchange_n(&l->state, &s, m->take(s), 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+				if (i > 0) {
+					spin_update(l, i);
+				}
+				*ps = s;
+				return 0;
+			}
+			continue;
+		}
+		*contended = 1;
+		if (i >= limit) {
+			break;
+		}
+		backoff(&pauses);
+		s = __atomic_load_n(&l->state, __ATOMIC_RELAXED);
+	}
+	if (limit > 0) {
+		spin_update(l, limit);
+	}
+
+	//a thread counts itself as waiting only if its count in state stays below the largest
+	//value (so that a writer draining the reader slots still fits in it); otherwise it
+	//yields until there is room, without sleeping, as no unlock would wake it
+	int waiting = 0;
+	s = __atomic_load_n(&l->state, __ATOMIC_RELAXED);
+	while (1) {
+		if (m->can(s)) {
+			if (__atomic_compare_exchange_n(&l->state, &s, m->take(s) - (waiting ? m->wait : 0), 0,
+							__ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+				*ps = s;
+				return 0;
+			}
+			continue;
+		}
+		if (waiting) {
+			if (futex_wait(l, s, expire, m->bits) == ETIMEDOUT) {
+				*ps = __atomic_sub_fetch(&l->state, m->wait, __ATOMIC_RELAXED);
+				return ETIMEDOUT;
+			}
+		} else if (m->waiting(s) < RWL_MAX_WAITING - 1) {
+			if (__atomic_compare_exchange_n(&l->state, &s, s + m->wait, 0,
+							__ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+				s += m->wait;
+				waiting = 1;
+				if (l->stats) {
+					stats_waiting(l, s);
+				}
+			}
+			continue;
+		} else {
+			if (expire != NULL && expired(expire)) {
+				*ps = s;
+				return ETIMEDOUT;
+			}
+			sched_yield();
+		}
+		s = __atomic_load_n(&l->state, __ATOMIC_RELAXED);
+	}
 }
 
 //rwl_init initializes the reader-writer lock 
 void
 rwl_init(rwl *l)
 {
-	//Your code here
+	l->state = RWL_DRAIN;
+	l->spins = 0;
+	l->rbias = 1;
+	l->inhibit_until = 0;
+	l->stats = NULL;
+}
+
+//rwl_destroy releases the resources of an unlocked reader-writer lock
+void
+rwl_destroy(rwl *l)
+{
+	assert(active_readers(l->state) == 0 && !(l->state & RWL_WRITER));
+	free(l->stats);
 }
 
 //rwl_nwaiters returns the number of threads *waiting* to acquire the lock
 //Note: it should not include any thread who has already grabbed the lock
+//(nor the threads that are still spinning for it)
 int
 rwl_nwaiters(rwl *l) 
 {
-	//Your code here
-	return 0;
+	unsigned int s = __atomic_load_n(&l->state, __ATOMIC_ACQUIRE);
+	return waiting_readers(s) + waiting_writers(s) + ((s & RWL_UPGRADING) != 0);
+}
 
+static int
+rlock(rwl *l, const struct timespec *expire, int *contended)
+{
+	rwl **slots;
+	if (__atomic_load_n(&l->rbias, __ATOMIC_RELAXED) && (slots = thread_slots()) != NULL) {
+		rwl **slot = &slots[slot_of(l)];
+		if (*slot == NULL) {
+			__atomic_store_n(slot, l, __ATOMIC_SEQ_CST);
+			//a writer that revokes the bias after this load will see the slot
+			if (__atomic_load_n(&l->rbias, __ATOMIC_SEQ_CST)) {
+				return 0;
+			}
+			__atomic_store_n(slot, NULL, __ATOMIC_RELEASE);
+		}
+	}
+
+	unsigned int s;
+	if (lock_mode(l, &read_mode, expire, &s, contended) == ETIMEDOUT) {
+		return ETIMEDOUT;
+	}
+	//no writer is waiting, let the next readers use their slots again
+	if (!__atomic_load_n(&l->rbias, __ATOMIC_RELAXED) && now() >= l->inhibit_until) {
+		__atomic_fetch_or(&l->state, RWL_DRAIN, __ATOMIC_RELAXED);
+		__atomic_store_n(&l->rbias, 1, __ATOMIC_RELAXED);
+	}
+	return 0;
 }
 
 //rwl_rlock attempts to grab the lock in "read" mode
@@ -50,15 +525,158 @@ rwl_nwaiters(rwl *l)
 int
 rwl_rlock(rwl *l, const struct timespec *expire)
 {
-	//Your code here
-	return 0;
+	int contended = 0;
+	if (l->stats == NULL) {
+		return rlock(l, expire, &contended);
+	}
+	long long t0 = clock_ns();
+	int r = rlock(l, expire, &contended);
+	stats_locked(l, RWL_READ, r, t0, contended);
+	return r;
 }
 
 //rwl_runlock unlocks the lock held in the "read" mode
 void
 rwl_runlock(rwl *l)
 {
-	//Your code here
+	if (l->stats) {
+		stats_unlocked(l, RWL_READ);
+	}
+	//only a thread that has checked in before can hold l through its slot
+	if (my_slots != NULL && my_slots[slot_of(l)] == l) {
+		__atomic_store_n(&my_slots[slot_of(l)], NULL, __ATOMIC_RELEASE);
+		return;
+	}
+	unsigned int s = __atomic_sub_fetch(&l->state, RWL_READER, __ATOMIC_RELEASE);
+	assert(active_readers(s) != RWL_MAX_READERS);
+	wake_after_read(l, s);
+}
+
+//rwl_ulock attempts to grab the lock in "intent" mode, alongside the readers
+//if lock is not grabbed before absolute time "expire", it returns ETIMEDOUT
+//else it returns 0 (when successfully grabbing the lock)
+int
+rwl_ulock(rwl *l, const struct timespec *expire)
+{
+	unsigned int s;
+	int contended = 0;
+	if (l->stats == NULL) {
+		return lock_mode(l, &intent_mode, expire, &s, &contended);
+	}
+	long long t0 = clock_ns();
+	int r = lock_mode(l, &intent_mode, expire, &s, &contended);
+	stats_locked(l, RWL_INTENT, r, t0, contended);
+	return r;
+}
+
+//rwl_uunlock unlocks the lock held in the "intent" mode
+void
+rwl_uunlock(rwl *l)
+{
+	assert(l->state & RWL_INTENT_HELD);
+	if (l->stats) {
+		stats_unlocked(l, RWL_INTENT);
+	}
+	unsigned int s = __atomic_sub_fetch(&l->state, RWL_READER + RWL_INTENT_HELD, __ATOMIC_RELEASE);
+	wake_after_read(l, s);
+	if (waiting_readers(s) > 0 && can_intent(s)) {
+		futex_wake(l, 1, WAKE_INTENT);
+	}
+}
+
+static int
+upgrade(rwl *l, const struct timespec *expire, int *contended)
+{
+	//new readers must queue behind the upgrade
+	if (__atomic_load_n(&l->rbias, __ATOMIC_RELAXED)) {
+		__atomic_store_n(&l->rbias, 0, __ATOMIC_SEQ_CST);
+	}
+	unsigned int s = __atomic_load_n(&l->state, __ATOMIC_RELAXED);
+	assert(s & RWL_INTENT_HELD);
+	//usually no reader is there, and the upgrade is a single CAS
+	if (active_readers(s) == 1 && !(s & RWL_DRAIN) &&
+	    __atomic_compare_exchange_n(&l->state, &s, s - RWL_READER - RWL_INTENT_HELD + RWL_WRITER, 0,
+					__ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+		return 0;
+	}
+	*contended = 1;
+	s = __atomic_add_fetch(&l->state, RWL_UPGRADING, __ATOMIC_RELAXED);
+	if (l->stats) {
+		stats_waiting(l, s);
+	}
+	while (1) {
+		if (active_readers(s) == 1) {
+			//an upgrader that must drain the reader slots counts as waiting until it is done
+			unsigned int n = s - RWL_READER - RWL_INTENT_HELD + RWL_WRITER - ((s & RWL_DRAIN) ? 0 : RWL_UPGRADING);
+			if (__atomic_compare_exchange_n(&l->state, &s, n, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+				break;
+			}
+			continue;
+		}
+		if (futex_wait(l, s, expire, WAKE_UPGRADER) == ETIMEDOUT) {
+			s = __atomic_sub_fetch(&l->state, RWL_UPGRADING, __ATOMIC_RELAXED);
+			//the readers may have been held back only by the upgrade
+			wake_readers(l, s);
+			return ETIMEDOUT;
+		}
+		s = __atomic_load_n(&l->state, __ATOMIC_RELAXED);
+	}
+	if (!(s & RWL_DRAIN)) {
+		return 0;
+	}
+	if (revoke_bias(l, expire) == 0) {
+		__atomic_sub_fetch(&l->state, RWL_UPGRADING + RWL_DRAIN, __ATOMIC_RELAXED);
+		return 0;
+	}
+	//back to intent mode
+	s = __atomic_add_fetch(&l->state, RWL_READER + RWL_INTENT_HELD - RWL_UPGRADING - RWL_WRITER, __ATOMIC_RELEASE);
+	wake_readers(l, s);
+	return ETIMEDOUT;
+}
+
+//rwl_upgrade turns the lock held in "intent" mode into "write" mode, once the readers
+//have left. If they have not before absolute time "expire", it returns ETIMEDOUT, and
+//the lock is still held in "intent" mode; else it returns 0.
+int
+rwl_upgrade(rwl *l, const struct timespec *expire)
+{
+	int contended = 0;
+	if (l->stats == NULL) {
+		return upgrade(l, expire, &contended);
+	}
+	long long t0 = clock_ns();
+	int r = upgrade(l, expire, &contended);
+	if (r == 0) {
+		stats_unlocked(l, RWL_INTENT);
+	}
+	stats_locked(l, RWL_WRITE, r, t0, contended);
+	return r;
+}
+
+static int
+wlock(rwl *l, const struct timespec *expire, int *contended)
+{
+	//new readers must queue behind this writer on state
+	if (__atomic_load_n(&l->rbias, __ATOMIC_RELAXED)) {
+		__atomic_store_n(&l->rbias, 0, __ATOMIC_SEQ_CST);
+	}
+
+	unsigned int s;
+	if (lock_mode(l, &write_mode, expire, &s, contended) == ETIMEDOUT) {
+		//the readers may have been held back only by this writer
+		wake_waiters(l, s);
+		return ETIMEDOUT;
+	}
+	if (!(s & RWL_DRAIN)) {
+		return 0;
+	}
+	if (revoke_bias(l, expire) == 0) {
+		__atomic_sub_fetch(&l->state, RWL_WAIT_WRITER + RWL_DRAIN, __ATOMIC_RELAXED);
+		return 0;
+	}
+	s = __atomic_sub_fetch(&l->state, RWL_WAIT_WRITER + RWL_WRITER, __ATOMIC_RELEASE);
+	wake_waiters(l, s);
+	return ETIMEDOUT;
 }
 
 //rwl_wlock attempts to grab the lock in "write" mode
@@ -67,13 +685,112 @@ rwl_runlock(rwl *l)
 int
 rwl_wlock(rwl *l, const struct timespec *expire)
 {
-	//Your code here
-	return 0;
+	int contended = 0;
+	if (l->stats == NULL) {
+		return wlock(l, expire, &contended);
+	}
+	long long t0 = clock_ns();
+	int r = wlock(l, expire, &contended);
+	stats_locked(l, RWL_WRITE, r, t0, contended);
+	return r;
 }
 
 //rwl_wunlock unlocks the lock held in the "write" mode
 void
 rwl_wunlock(rwl *l)
 {
-	//Your code here
+	assert(l->state & RWL_WRITER);
+	if (l->stats) {
+		stats_unlocked(l, RWL_WRITE);
+	}
+	unsigned int s = __atomic_sub_fetch(&l->state, RWL_WRITER, __ATOMIC_RELEASE);
+	if (waiting_readers(s) + waiting_writers(s) > 0) {
+		wake_waiters(l, s);
+	}
+}
+
+//rwl_downgrade turns the lock held in "write" mode into "read" mode, letting in the
+//readers that wait, unless writers wait too
+void
+rwl_downgrade(rwl *l)
+{
+	assert(l->state & RWL_WRITER);
+	if (l->stats) {
+		stats_unlocked(l, RWL_WRITE);
+		stats_locked(l, RWL_READ, 0, clock_ns(), 0);
+	}
+	unsigned int s = __atomic_add_fetch(&l->state, RWL_READER - RWL_WRITER, __ATOMIC_RELEASE);
+	wake_readers(l, s);
+}
+
+//rwl_stats_enable makes l keep statistics of its use, see rwl_stats. It must be called
+//before other threads use l. If there is no memory for them, l keeps none.
+void
+rwl_stats_enable(rwl *l)
+{
+	if (l->stats != NULL) {
+		return;
+	}
+	rwl_stats *stats;
+	if (posix_memalign((void **)&stats, CACHE_LINE, sizeof(rwl_stats)*TID_MAX) != 0) {
+		return;
+	}
+	memset(stats, 0, sizeof(rwl_stats)*TID_MAX);
+	l->stats = stats;
+}
+
+//rwl_stats_get adds the statistics of all threads for l to *sum. While other threads use
+//l, the result may miss their latest operations.
+void
+rwl_stats_get(rwl *l, rwl_stats *sum)
+{
+	if (l->stats == NULL) {
+		return;
+	}
+	for (int t = 0; t < TID_MAX; t++) {
+		rwl_stats *st = &l->stats[t];
+		for (int k = 0; k < RWL_NKINDS; k++) {
+			sum->acquired[k] += st->acquired[k];
+			sum->contended[k] += st->contended[k];
+			sum->timeouts[k] += st->timeouts[k];
+		}
+		for (int i = 0; i < RWL_HIST_BUCKETS; i++) {
+			sum->wait_hist[i] += st->wait_hist[i];
+			sum->hold_hist[i] += st->hold_hist[i];
+		}
+		if (st->max_waiting_readers > sum->max_waiting_readers) {
+			sum->max_waiting_readers = st->max_waiting_readers;
+		}
+		if (st->max_waiting_writers > sum->max_waiting_writers) {
+			sum->max_waiting_writers = st->max_waiting_writers;
+		}
+	}
+}
+
+//print_hist prints the non-empty buckets of a log2 histogram of times
+static void
+print_hist(const char *what, const unsigned long *hist)
+{
+	printf("  %s time (ns):", what);
+	for (int i = 0; i < RWL_HIST_BUCKETS; i++) {
+		if (hist[i]) {
+			printf(" %lu-%lu:%lu", 1UL << i, 2UL << i, hist[i]);
+		}
+	}
+	printf("\n");
+}
+
+//rwl_stats_print prints st, the statistics of the lock (or locks) called name
+void
+rwl_stats_print(const char *name, const rwl_stats *st)
+{
+	static const char *kinds[RWL_NKINDS] = {"read", "intent", "write"};
+	printf("%s:\n", name);
+	for (int k = 0; k < RWL_NKINDS; k++) {
+		printf("  %s: %lu acquired, %lu contended, %lu timeouts\n",
+		       kinds[k], st->acquired[k], st->contended[k], st->timeouts[k]);
+	}
+	printf("  at most %d readers and %d writers waiting\n", st->max_waiting_readers, st->max_waiting_writers);
+	print_hist("wait", st->wait_hist);
+	print_hist("hold", st->hold_hist);
 }
@@ -1,15 +1,60 @@
 #ifndef RWLOCK_H
 #define RWLOCK_H
 
+#include <time.h>
+#include <pthread.h>
+
+#define CACHE_LINE 64
+//number of reader slots of each thread; a lock always uses the same slot of every thread
+#define RWL_READER_SLOTS 8
+//once revoked, reader bias stays off RWL_INHIBIT_MULT times as long as the revocation took
+#define RWL_INHIBIT_MULT 9
+//a thread spins at most RWL_MAX_SPIN times for a busy lock before it sleeps
+#define RWL_MAX_SPIN 100
+
+//the modes a lock is taken in, as counted by rwl_stats
+enum rwl_kind {RWL_READ, RWL_INTENT, RWL_WRITE, RWL_NKINDS};
+
+//number of log2 buckets of the wait and hold time histograms
+#define RWL_HIST_BUCKETS 32
+
+//rwl_stats counts what happened to a lock whose statistics are enabled. Each thread
+//counts into its own rwl_stats, rwl_stats_get adds them up.
+typedef struct {
+	unsigned long acquired[RWL_NKINDS]; //acquisitions in each mode
+	unsigned long contended[RWL_NKINDS]; //acquisitions that had to spin or sleep
+	unsigned long timeouts[RWL_NKINDS];
+	unsigned long wait_hist[RWL_HIST_BUCKETS]; //bucket i counts waits of [2^i, 2^(i+1)) ns
+	unsigned long hold_hist[RWL_HIST_BUCKETS]; //the same for the times the lock was held
+	int max_waiting_readers; //the most readers (and intent waiters) seen waiting at once
+	int max_waiting_writers; //the same for writers (and an upgrader)
+	long long held_since[RWL_NKINDS]; //when the thread last took the lock in each mode
+} __attribute__((aligned(CACHE_LINE))) rwl_stats;
+
+//rwl puts no limit on the number of threads, but its state only counts up to 1022 readers
+//holding it (readers past that wait for one to leave) and up to 510 readers and 510
+//writers sleeping on it (threads past that yield until they fit instead of sleeping).
 typedef struct {
-	//Your code here
-}rwl;
+	unsigned int state; //the active and waiting readers and writers, see rwlock.c
+	int spins; //about how many times a thread spun lately before it got the lock
+	int rbias; //1 while readers may check in through their reader slots instead of state
+	long long inhibit_until; //time stamp counter value before which rbias is not set again
+	rwl_stats *stats; //TID_MAX per-thread statistics, NULL unless enabled
+} __attribute__((aligned(CACHE_LINE))) rwl;
 
 void rwl_init(rwl *l);
+void rwl_destroy(rwl *l);
 int rwl_nwaiters(rwl *l);
 int rwl_rlock(rwl *l, const struct timespec *expire);
 void rwl_runlock(rwl *l);
+int rwl_ulock(rwl *l, const struct timespec *expire);
+void rwl_uunlock(rwl *l);
+int rwl_upgrade(rwl *l, const struct timespec *expire);
 int rwl_wlock(rwl *l, const struct timespec *expire);
 void rwl_wunlock(rwl *l);
+void rwl_downgrade(rwl *l);
+void rwl_stats_enable(rwl *l);
+void rwl_stats_get(rwl *l, rwl_stats *sum);
+void rwl_stats_print(const char *name, const rwl_stats *st);
 
 #endif
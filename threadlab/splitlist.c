@@ -0,0 +1,318 @@
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdint.h>
+
+#include "splitlist.h"
+
+/* splitlist implements a lock-free hash table with split-ordered lists (Shalev and Shavit).
+ * All key/value tuples live in one singly-linked list, sorted by their bit-reversed
+ * hashcode. With 2^k buckets, the tuples of bucket b (hashcode % 2^k == b) then form a
+ * contiguous sublist, which starts right after a "dummy" node whose so_key is the
+ * reversed b. The bucket array only stores pointers to these dummy nodes.
+ * Doubling the number of buckets splits bucket b into b and b + 2^k. Bucket b + 2^k
+ * starts in the middle of the sublist of b, so nodes never move: its dummy node is
+ * inserted there the first time the bucket is used ("lazy initialization").
+ * Inserts link their node with a single compare-and-swap and restart from the bucket's
+ * dummy node if it fails, and lookups simply walk the list, so neither takes a lock.
+ * Removal follows Harris and Michael: sl_remove first marks the node's next pointer,
+ * which removes it logically and stops anyone from linking a node after it, then
+ * unlinks it with a CAS on its predecessor (or leaves that to the next list_find).
+ * Lookups may still be walking through an unlinked node, so it is retired to an
+ * epoch-based reclamation domain and only returned to the nodepool once no operation
+ * can reach it. Every operation is an ebr critical section.
+ */
+
+//reverse returns x with the order of its 64 bits reversed
+static inline unsigned long long
+reverse(unsigned long long x)
+{
+	x = ((x >> 1) & 0x5555555555555555ULL) | ((x & 0x5555555555555555ULL) << 1);
+	x = ((x >> 2) & 0x3333333333333333ULL) | ((x & 0x3333333333333333ULL) << 2);
+	x = ((x >> 4) & 0x0f0f0f0f0f0f0f0fULL) | ((x & 0x0f0f0f0f0f0f0f0fULL) << 4);
+	return __builtin_bswap64(x);
+}
+
+//so_regular returns the split-order key of a key/value tuple
+static inline unsigned long long
+so_regular(unsigned long long hcode)
+{
+	return reverse(hcode) | 1;
+}
+
+//so_dummy returns the split-order key of bucket b's dummy node
+static inline unsigned long long
+so_dummy(unsigned int b)
+{
+	return reverse(b) & ~1ULL;
+}
+
+//parent returns the bucket that bucket b was split from
+static inline unsigned int
+parent(unsigned int b)
+{
+	return b & ~(1u << (31 - __builtin_clz(b)));
+}
+
+//bucket_ref returns the address of bucket b's slot, allocating its segment if needed
+static sl_node **
+bucket_ref(splitlist *sl, unsigned int b)
+{
+	int seg = (b == 0) ? 0 : 32 - __builtin_clz(b);
+	unsigned int idx = (b == 0) ? 0 : b - (1u << (seg - 1));
+	sl_node **s = __atomic_load_n(&sl->segments[seg], __ATOMIC_ACQUIRE);
+	if (s == NULL) {
+		unsigned int n = (seg == 0) ? 1 : 1u << (seg - 1);
+		sl_node **fresh = (sl_node **)calloc(n, sizeof(sl_node *));
+		assert(fresh);
+		if (__atomic_compare_exchange_n(&sl->segments[seg], &s, fresh, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+			s = fresh;
+		} else {
+			free(fresh); //another thread allocated it first
+		}
+	}
+	return &s[idx];
+}
+
+//a node is removed by setting the lowest bit of its next pointer ("marking" it),
+//which makes every CAS that would link a node after it fail
+static inline int
+is_marked(sl_node *p)
+{
+	return (uintptr_t)p & 1;
+}
+
+static inline sl_node *
+marked(sl_node *p)
+{
+	return (sl_node *)((uintptr_t)p | 1);
+}
+
+static inline sl_node *
+unmarked(sl_node *p)
+{
+	return (sl_node *)((uintptr_t)p & ~(uintptr_t)1);
+}
+
+//list_find searches the list after head for the node with so_key and the klen bytes of
+//key (a dummy node if key is NULL). It unlinks the removed nodes it goes through and retires them.
+//It returns 1 if the node is found, and stores it in *pcurr and its predecessor in *pprev.
+//Otherwise it returns 0, and a new node would go between *pprev and *pcurr.
+static int
+list_find(splitlist *sl, sl_node *head, unsigned long long so_key, const char *key, int klen,
+	  sl_node **pprev, sl_node **pcurr)
+{
+retry:
+	;
+	sl_node *prev = head; //dummy nodes are never removed
+	sl_node *curr = __atomic_load_n(&prev->next, __ATOMIC_ACQUIRE);
+	while (curr) {
+		sl_node *next = __atomic_load_n(&curr->next, __ATOMIC_ACQUIRE);
+		if (is_marked(next)) {
+			//curr has been removed, unlink it before going on
+			sl_node *expected = curr;
+			if (!__atomic_compare_exchange_n(&prev->next, &expected, unmarked(next), 0,
+							 __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+				goto retry; //prev has changed (or has been removed too)
+			}
+			ebr_retire(&sl->ebr, curr);
+			curr = unmarked(next);
+			continue;
+		}
+		if (curr->so_key > so_key) {
+			break;
+		}
+		if (curr->so_key == so_key && (key == NULL || htkey_eq(&curr->key, key, klen))) {
+			*pprev = prev;
+			*pcurr = curr;
+			return 1;
+		}
+		prev = curr;
+		curr = next;
+	}
+	*pprev = prev;
+	*pcurr = curr;
+	return 0;
+}
+
+//list_insert links n, whose key is the klen bytes of key (NULL for a dummy), into the
+//list after head, keeping the list sorted by so_key. If an equal node is already there, it returns that node
+//and leaves n unlinked. Otherwise it returns n.
+static sl_node *
+list_insert(splitlist *sl, sl_node *head, sl_node *n, const char *key, int klen)
+{
+	while (1) {
+		sl_node *prev, *curr;
+		if (list_find(sl, head, n->so_key, key, klen, &prev, &curr)) {
+			return curr;
+		}
+		n->next = curr;
+		if (__atomic_compare_exchange_n(&prev->next, &curr, n, 0, __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+			return n;
+		}
+		//another node was linked after prev, or prev was removed, in the meantime: search again
+	}
+}
+
+//get_bucket returns the dummy node of bucket b, inserting it (and its parents) if needed
+static sl_node *
+get_bucket(splitlist *sl, unsigned int b)
+{
+	sl_node **ref = bucket_ref(sl, b);
+	sl_node *d = __atomic_load_n(ref, __ATOMIC_ACQUIRE);
+	if (d != NULL) {
+		return d;
+	}
+	sl_node *p = get_bucket(sl, parent(b));
+	sl_node *n = (sl_node *)pool_alloc(&sl->pool);
+	n->so_key = so_dummy(b);
+	n->key.len = 0;
+	n->val = NULL;
+	d = list_insert(sl, p, n, NULL, 0);
+	if (d != n) {
+		pool_free(&sl->pool, n);
+	}
+	__atomic_store_n(ref, d, __ATOMIC_RELEASE);
+	return d;
+}
+
+//free_node returns a retired node to the pool
+static void
+free_node(void *arg, void *obj)
+{
+	pool_free((nodepool *)arg, obj);
+}
+
+//sl_init initializes a split-ordered list with at least sz buckets
+void
+sl_init(splitlist *sl, int sz, int allow_resize)
+{
+	memset(sl, 0, sizeof(splitlist));
+	sl->allow_resize = allow_resize;
+	sl->size = 1;
+	while (sl->size < (unsigned int)sz) {
+		sl->size <<= 1;
+	}
+	pool_init(&sl->pool, sizeof(sl_node));
+	ebr_init(&sl->ebr, free_node, &sl->pool);
+	//bucket 0's dummy node is the head of the whole list
+	sl_node *head = (sl_node *)pool_alloc(&sl->pool);
+	head->so_key = 0;
+	head->key.len = 0;
+	head->val = NULL;
+	head->next = NULL;
+	*bucket_ref(sl, 0) = head;
+}
+
+//sl_destroy frees all nodes and the bucket array; no other thread may use sl
+void
+sl_destroy(splitlist *sl)
+{
+	ebr_destroy(&sl->ebr);
+	pool_destroy(&sl->pool);
+	for (int i = 0; i < SL_SEGMENTS; i++) {
+		free(sl->segments[i]);
+	}
+}
+
+//sl_size returns the number of buckets
+int
+sl_size(splitlist *sl)
+{
+	return __atomic_load_n(&sl->size, __ATOMIC_RELAXED);
+}
+
+//sl_reserve makes room for n tuples: it raises the number of buckets to keep the load
+//below SL_MAX_LOAD. The new buckets are still initialized lazily.
+void
+sl_reserve(splitlist *sl, int n)
+{
+	unsigned int size = 1;
+	while (size < (1u << (SL_SEGMENTS - 2)) && size*SL_MAX_LOAD < (unsigned int)n) {
+		size <<= 1;
+	}
+	unsigned int curr = __atomic_load_n(&sl->size, __ATOMIC_RELAXED);
+	while (curr < size && !__atomic_compare_exchange_n(&sl->size, &curr, size, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+	}
+}
+
+//sl_insert inserts the key, val tuple with hashcode hcode. It returns 1 if the key
+//already exists and 0 otherwise.
+int
+sl_insert(splitlist *sl, unsigned long long hcode, char *key, int klen, void *val)
+{
+	ebr_enter(&sl->ebr);
+	unsigned int size = __atomic_load_n(&sl->size, __ATOMIC_RELAXED);
+	sl_node *d = get_bucket(sl, hcode & (size - 1));
+	sl_node *n = (sl_node *)pool_alloc(&sl->pool);
+	n->so_key = so_regular(hcode);
+	htkey_set(&n->key, key, klen);
+	n->val = val;
+	if (list_insert(sl, d, n, key, klen) != n) {
+		pool_free(&sl->pool, n); //no other thread has seen n
+		ebr_exit(&sl->ebr);
+		return 1;
+	}
+	ebr_exit(&sl->ebr);
+	unsigned int count = __atomic_add_fetch(&sl->count, 1, __ATOMIC_RELAXED);
+	if (sl->allow_resize && count / size > SL_MAX_LOAD && size < (1u << (SL_SEGMENTS - 2))) {
+		//only the first thread to see this size doubles it, no node has to move
+		__atomic_compare_exchange_n(&sl->size, &size, size << 1, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+	}
+	return 0;
+}
+
+//sl_lookup returns the val of key, with hashcode hcode, or NULL if it does not exist
+void *
+sl_lookup(splitlist *sl, unsigned long long hcode, char *key, int klen)
+{
+	ebr_enter(&sl->ebr);
+	unsigned int size = __atomic_load_n(&sl->size, __ATOMIC_RELAXED);
+	unsigned long long so_key = so_regular(hcode);
+	sl_node *curr = get_bucket(sl, hcode & (size - 1));
+	void *val = NULL;
+	while (curr && curr->so_key <= so_key) {
+		sl_node *next = __atomic_load_n(&curr->next, __ATOMIC_ACQUIRE);
+		//a marked node has been removed, but its next pointer still leads on
+		if (curr->so_key == so_key && !is_marked(next) && htkey_eq(&curr->key, key, klen)) {
+			val = curr->val;
+			break;
+		}
+		curr = unmarked(next);
+	}
+	ebr_exit(&sl->ebr);
+	return val;
+}
+
+//sl_remove removes key, with hashcode hcode. It returns 1 if the key does not exist
+//and 0 otherwise.
+int
+sl_remove(splitlist *sl, unsigned long long hcode, char *key, int klen)
+{
+	ebr_enter(&sl->ebr);
+	unsigned int size = __atomic_load_n(&sl->size, __ATOMIC_RELAXED);
+	sl_node *d = get_bucket(sl, hcode & (size - 1));
+	unsigned long long so_key = so_regular(hcode);
+	while (1) {
+		sl_node *prev, *curr;
+		if (!list_find(sl, d, so_key, key, klen, &prev, &curr)) {
+			ebr_exit(&sl->ebr);
+			return 1;
+		}
+		sl_node *next = __atomic_load_n(&curr->next, __ATOMIC_ACQUIRE);
+		if (is_marked(next) ||
+		    !__atomic_compare_exchange_n(&curr->next, &next, marked(next), 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+			continue; //being removed by another thread, or a node was just linked after it
+		}
+		//curr is now removed, try to unlink it too
+		if (__atomic_compare_exchange_n(&prev->next, &curr, next, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+			ebr_retire(&sl->ebr, curr);
+		} else {
+			list_find(sl, d, so_key, key, klen, &prev, &curr);
+		}
+		__atomic_sub_fetch(&sl->count, 1, __ATOMIC_RELAXED);
+		ebr_exit(&sl->ebr);
+		return 0;
+	}
+}
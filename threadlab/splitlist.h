@@ -0,0 +1,39 @@
+#ifndef SPLITLIST_H
+#define SPLITLIST_H
+
+#include "nodepool.h"
+#include "epoch.h"
+#include "htkey.h"
+
+//number of bucket segments, segment s > 0 holds 2^(s-1) buckets
+#define SL_SEGMENTS 33
+//the bucket array doubles once there are more than SL_MAX_LOAD nodes per bucket
+#define SL_MAX_LOAD 4
+
+//sl_node is a node of the split-ordered list: either a bucket's dummy node (even so_key,
+//empty key) or a key/value tuple. The lowest bit of next is set once the node has been removed.
+typedef struct sl_node {
+	unsigned long long so_key; //the bit-reversed hashcode, with the lowest bit set for regular nodes
+	htkey key;
+	void *val;
+	struct sl_node *next;
+}sl_node;
+
+typedef struct {
+	int allow_resize;
+	unsigned int size; //number of buckets, a power of 2
+	unsigned int count; //number of key/value tuples
+	sl_node **segments[SL_SEGMENTS]; //bucket -> dummy node, allocated on first use
+	nodepool pool; //where the nodes are allocated
+	ebr ebr; //where removed nodes wait until no lookup can reach them
+}splitlist;
+
+void sl_init(splitlist *sl, int sz, int allow_resize);
+void sl_destroy(splitlist *sl);
+int sl_size(splitlist *sl);
+void sl_reserve(splitlist *sl, int n);
+int sl_insert(splitlist *sl, unsigned long long hcode, char *key, int klen, void *val);
+void *sl_lookup(splitlist *sl, unsigned long long hcode, char *key, int klen);
+int sl_remove(splitlist *sl, unsigned long long hcode, char *key, int klen);
+
+#endif
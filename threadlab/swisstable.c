@@ -0,0 +1,274 @@
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include <stdio.h>
+#include <emmintrin.h>
+
+#include "swisstable.h"
+
+/* swisstable implements an open-addressing hash table in the style of Abseil's "Swiss
+ * tables". Tuples are stored inline in a flat slot array, so an insert allocates
+ * nothing and a lookup does not chase a chain of nodes. Next to the slots, a control
+ * array stores one byte per slot: SW_EMPTY, SW_DELETED, or a 7-bit tag taken from the
+ * slot's hash.
+ * The slots are split into groups of SW_GROUP. A probe loads the 16 control bytes of a
+ * group and compares them with the tag of the key in one SSE2 instruction; only the
+ * slots whose tag matches (1 in 128 of the others on average) have their key compared.
+ * If the group also has an empty slot, the key is not in the table, otherwise the
+ * probe moves on to the next group (triangular probing visits every group).
+ * A lookup thus costs about one cache miss for the control bytes and one for the slot.
+ * A removed slot becomes SW_DELETED (a "tombstone") so that probes keep going past it,
+ * unless its group still has an empty slot: then no probe ever went past the group,
+ * and the slot can become SW_EMPTY again.
+ *
+ * For thread safety, the table is split into SW_SHARDS shards by the top bits of the
+ * hash, each with its own rwl: lookups take it in read mode and inserts in write mode.
+ * A shard grows (doubling and reinserting its tuples) when it is 7/8 full. Open
+ * addressing cannot hold more tuples than slots, so shards always grow, whether the
+ * htable allows resizing or not.
+ */
+
+#define SW_EMPTY ((int8_t)0x80)
+#define SW_DELETED ((int8_t)0xfe)
+
+static inline int
+shard_of(unsigned long long h)
+{
+	return h >> (64 - __builtin_ctz(SW_SHARDS));
+}
+
+static inline int8_t
+tag_of(unsigned long long h)
+{
+	return h & 0x7f;
+}
+
+//match_tag returns a bitmask of the slots in the group at ctrl whose control byte is tag
+static inline unsigned int
+match_tag(const int8_t *ctrl, int8_t tag)
+{
+	__m128i g = _mm_load_si128((const __m128i *)ctrl);
+	return _mm_movemask_epi8(_mm_cmpeq_epi8(g, _mm_set1_epi8(tag)));
+}
+
+//match_empty returns a bitmask of the empty slots in the group at ctrl
+static inline unsigned int
+match_empty(const int8_t *ctrl)
+{
+	return match_tag(ctrl, SW_EMPTY);
+}
+
+//match_free returns a bitmask of the empty or deleted slots in the group at ctrl
+static inline unsigned int
+match_free(const int8_t *ctrl)
+{
+	//SW_EMPTY and SW_DELETED are the only control bytes with their top bit set
+	return _mm_movemask_epi8(_mm_load_si128((const __m128i *)ctrl));
+}
+
+static void
+shard_alloc(sw_shard *s, int cap)
+{
+	s->cap = cap;
+	if (posix_memalign((void **)&s->ctrl, SW_GROUP, cap) != 0) {
+		s->ctrl = NULL;
+	}
+	assert(s->ctrl);
+	memset(s->ctrl, SW_EMPTY, cap);
+	s->slots = (sw_slot *)malloc(sizeof(sw_slot)*cap);
+	assert(s->slots);
+	s->count = 0;
+	s->growth_left = cap - cap/8;
+}
+
+//find_slot returns the index of the slot of key, of klen bytes, in shard s, or -1 if it
+//is not there
+static int
+find_slot(sw_shard *s, unsigned long long h, const char *key, int klen)
+{
+	int8_t tag = tag_of(h);
+	int mask = s->cap/SW_GROUP - 1;
+	int g = (h >> 7) & mask;
+	for (int i = 1; ; i++) {
+		const int8_t *ctrl = s->ctrl + g*SW_GROUP;
+		unsigned int m = match_tag(ctrl, tag);
+		while (m) {
+			int idx = g*SW_GROUP + __builtin_ctz(m);
+			if (s->slots[idx].hashcode == h && htkey_eq(&s->slots[idx].key, key, klen)) {
+				return idx;
+			}
+			m &= m - 1;
+		}
+		if (match_empty(ctrl)) {
+			return -1;
+		}
+		g = (g + i) & mask;
+	}
+}
+
+//put stores a tuple that is not in shard s yet in the first free slot of its probe sequence
+static void
+put(sw_shard *s, unsigned long long h, const htkey *key, void *val)
+{
+	int mask = s->cap/SW_GROUP - 1;
+	int g = (h >> 7) & mask;
+	for (int i = 1; ; i++) {
+		unsigned int m = match_free(s->ctrl + g*SW_GROUP);
+		if (m) {
+			int idx = g*SW_GROUP + __builtin_ctz(m);
+			//reusing a tombstone does not bring the shard closer to its maximum load
+			if (s->ctrl[idx] == SW_EMPTY) {
+				s->growth_left--;
+			}
+			s->ctrl[idx] = tag_of(h);
+			s->slots[idx].key = *key;
+			s->slots[idx].val = val;
+			s->slots[idx].hashcode = h;
+			s->count++;
+			return;
+		}
+		g = (g + i) & mask;
+	}
+}
+
+//shard_resize changes the capacity of shard s to new_cap, reinserting all of its tuples
+static void
+shard_resize(sw_shard *s, int new_cap)
+{
+	int8_t *ctrl = s->ctrl;
+	sw_slot *slots = s->slots;
+	int cap = s->cap;
+	shard_alloc(s, new_cap);
+	for (int i = 0; i < cap; i++) {
+		if (ctrl[i] >= 0) {
+			put(s, slots[i].hashcode, &slots[i].key, slots[i].val);
+		}
+	}
+	free(ctrl);
+	free(slots);
+}
+
+//shard_cap returns the capacity a shard needs to hold its share of sz tuples
+static int
+shard_cap(int sz)
+{
+	//the shares are not exactly equal, leave 1/8 of slack
+	long per_shard = sz / SW_SHARDS + sz / SW_SHARDS / 8;
+	int cap = SW_GROUP;
+	while (cap - cap/8 < per_shard) {
+		cap *= 2;
+	}
+	return cap;
+}
+
+//sw_init initializes a swiss table with room for at least sz tuples
+void
+sw_init(swisstable *sw, int sz)
+{
+	int cap = shard_cap(sz);
+	if (posix_memalign((void **)&sw->shards, CACHE_LINE, sizeof(sw_shard)*SW_SHARDS) != 0) {
+		sw->shards = NULL;
+	}
+	assert(sw->shards);
+	for (int i = 0; i < SW_SHARDS; i++) {
+		rwl_init(&sw->shards[i].l);
+		shard_alloc(&sw->shards[i], cap);
+	}
+}
+
+void
+sw_destroy(swisstable *sw)
+{
+	for (int i = 0; i < SW_SHARDS; i++) {
+		rwl_destroy(&sw->shards[i].l);
+		free(sw->shards[i].ctrl);
+		free(sw->shards[i].slots);
+	}
+	free(sw->shards);
+}
+
+//sw_size returns the total number of slots
+int
+sw_size(swisstable *sw)
+{
+	int sz = 0;
+	for (int i = 0; i < SW_SHARDS; i++) {
+		rwl_rlock(&sw->shards[i].l, NULL);
+		sz += sw->shards[i].cap;
+		rwl_runlock(&sw->shards[i].l);
+	}
+	return sz;
+}
+
+//sw_reserve makes room for n tuples in total
+void
+sw_reserve(swisstable *sw, int n)
+{
+	int cap = shard_cap(n);
+	for (int i = 0; i < SW_SHARDS; i++) {
+		sw_shard *s = &sw->shards[i];
+		rwl_wlock(&s->l, NULL);
+		if (s->cap < cap) {
+			shard_resize(s, cap);
+		}
+		rwl_wunlock(&s->l);
+	}
+}
+
+//sw_insert inserts the key, val tuple with hashcode h. It returns 1 if the key
+//already exists and 0 otherwise.
+int
+sw_insert(swisstable *sw, unsigned long long h, char *key, int klen, void *val)
+{
+	sw_shard *s = &sw->shards[shard_of(h)];
+	rwl_wlock(&s->l, NULL);
+	if (find_slot(s, h, key, klen) >= 0) {
+		rwl_wunlock(&s->l);
+		return 1;
+	}
+	if (s->growth_left == 0) {
+		//if tombstones fill most of the shard, rehashing at the same size drops them
+		int max_load = s->cap - s->cap/8;
+		shard_resize(s, (s->count < max_load/2) ? s->cap : 2*s->cap);
+	}
+	htkey k;
+	htkey_set(&k, key, klen);
+	put(s, h, &k, val);
+	rwl_wunlock(&s->l);
+	return 0;
+}
+
+//sw_lookup returns the val of key, with hashcode h, or NULL if it does not exist
+void *
+sw_lookup(swisstable *sw, unsigned long long h, char *key, int klen)
+{
+	sw_shard *s = &sw->shards[shard_of(h)];
+	rwl_rlock(&s->l, NULL);
+	int idx = find_slot(s, h, key, klen);
+	void *val = (idx >= 0) ? s->slots[idx].val : NULL;
+	rwl_runlock(&s->l);
+	return val;
+}
+
+//sw_remove removes key, with hashcode h. It returns 1 if the key does not exist and
+//0 otherwise.
+int
+sw_remove(swisstable *sw, unsigned long long h, char *key, int klen)
+{
+	sw_shard *s = &sw->shards[shard_of(h)];
+	rwl_wlock(&s->l, NULL);
+	int idx = find_slot(s, h, key, klen);
+	if (idx < 0) {
+		rwl_wunlock(&s->l);
+		return 1;
+	}
+	if (match_empty(s->ctrl + idx/SW_GROUP*SW_GROUP)) {
+		s->ctrl[idx] = SW_EMPTY;
+		s->growth_left++;
+	} else {
+		s->ctrl[idx] = SW_DELETED;
+	}
+	s->count--;
+	rwl_wunlock(&s->l);
+	return 0;
+}
@@ -0,0 +1,43 @@
+#ifndef SWISSTABLE_H
+#define SWISSTABLE_H
+
+#include <stdint.h>
+
+#include "rwlock.h"
+#include "htkey.h"
+
+//number of control bytes compared at once, and the size of a slot group
+#define SW_GROUP 16
+//number of independently locked shards, must be a power of 2
+#define SW_SHARDS 64
+
+//sw_slot stores one key/value tuple inline in the slot array
+typedef struct {
+	htkey key;
+	void *val;
+	unsigned long long hashcode;
+}sw_slot;
+
+//sw_shard is an open-addressing table of its own, protected by its own lock
+typedef struct {
+	rwl l;
+	int8_t *ctrl; //one control byte per slot: SW_EMPTY, SW_DELETED or the 7-bit tag of the slot's hash
+	sw_slot *slots;
+	int cap; //number of slots, a power of 2 and a multiple of SW_GROUP
+	int count; //number of tuples
+	int growth_left; //inserts into empty slots left before the shard reaches its maximum load
+} __attribute__((aligned(CACHE_LINE))) sw_shard;
+
+typedef struct {
+	sw_shard *shards;
+}swisstable;
+
+void sw_init(swisstable *sw, int sz);
+void sw_destroy(swisstable *sw);
+int sw_size(swisstable *sw);
+void sw_reserve(swisstable *sw, int n);
+int sw_insert(swisstable *sw, unsigned long long h, char *key, int klen, void *val);
+void *sw_lookup(swisstable *sw, unsigned long long h, char *key, int klen);
+int sw_remove(swisstable *sw, unsigned long long h, char *key, int klen);
+
+#endif
@@ -5,18 +5,30 @@
 #include <string.h>
 #include <pthread.h>
 
-void test_htable();
+#include "htable.h"
+
+void test_htable(int allow_resize, enum ht_backend backend);
+void test_htable_batch(enum ht_backend backend);
+void test_htable_churn(enum ht_backend backend);
+void test_htable_keys(enum ht_backend backend);
+void test_htable_reserve(enum ht_backend backend);
+void test_htable_skew(enum ht_backend backend);
 void test_rwl_basic();
 void test_rwl_priority();
+void test_rwl_upgrade();
+void test_rwl_many_readers();
+void test_rwl_many_waiters();
+void test_rwl_handoff();
 
 int num_threads = 4;
+int lock_stats = 0;
 
 int
 main(int argc, char **argv)
 {
 	char *which_test = "all";
 	int c;
-	while ((c = getopt(argc, argv, "n:t:")) != -1) {
+	while ((c = getopt(argc, argv, "n:t:s")) != -1) {
 	       	switch (c) {
 			case 'n':
 				num_threads = atoi(optarg);
@@ -24,29 +36,84 @@ main(int argc, char **argv)
 			case 't':
 				which_test = optarg;
 				break;
+			case 's':
+				lock_stats = 1;
+				break;
 			default:
 				fprintf(stderr, "Usage: tester \n");
 			       	fprintf(stderr, "Options\n");
-			       	fprintf(stderr, "\t-t <htable, rwl, resize, all>   Which test to run\n");
+			       	fprintf(stderr, "\t-t <htable, rwl, handoff, resize, lockfree, swiss, batch, churn, keys, reserve, skew, all>   Which test to run\n");
 			       	fprintf(stderr, "\t-n <num>   Number of testing threads (default is %d)\n", num_threads);
+			       	fprintf(stderr, "\t-s   Print lock statistics\n");
 			       	exit(1);
 		}
 	}
 
 	int tested = 0;
 	if (strcmp(which_test, "all") == 0 || strcmp(which_test, "htable") == 0) {
-		test_htable(0); 
+		test_htable(0, HT_STRIPED); 
 		tested++;
 	}
 	
 	if (strcmp(which_test, "all") == 0 || strcmp(which_test, "rwl") == 0) {
 		test_rwl_basic();
 		test_rwl_priority();
+		test_rwl_upgrade();
+		test_rwl_many_readers();
+		test_rwl_many_waiters();
+		tested++;
+	}
+
+	if (strcmp(which_test, "all") == 0 || strcmp(which_test, "handoff") == 0) {
+		test_rwl_handoff();
 		tested++;
 	}
 	
 	if (strcmp(which_test, "all") == 0 || strcmp(which_test, "resize") == 0) {
-		test_htable(1);
+		test_htable(1, HT_STRIPED);
+		tested++;
+	}
+
+	if (strcmp(which_test, "all") == 0 || strcmp(which_test, "lockfree") == 0) {
+		test_htable(1, HT_SPLITLIST);
+		tested++;
+	}
+
+	if (strcmp(which_test, "all") == 0 || strcmp(which_test, "swiss") == 0) {
+		test_htable(1, HT_SWISS);
+		tested++;
+	}
+
+	if (strcmp(which_test, "all") == 0 || strcmp(which_test, "batch") == 0) {
+		test_htable_batch(HT_STRIPED);
+		test_htable_batch(HT_SPLITLIST);
+		test_htable_batch(HT_SWISS);
+		tested++;
+	}
+
+	if (strcmp(which_test, "all") == 0 || strcmp(which_test, "churn") == 0) {
+		test_htable_churn(HT_STRIPED);
+		test_htable_churn(HT_SPLITLIST);
+		test_htable_churn(HT_SWISS);
+		tested++;
+	}
+
+	if (strcmp(which_test, "all") == 0 || strcmp(which_test, "keys") == 0) {
+		test_htable_keys(HT_STRIPED);
+		test_htable_keys(HT_SPLITLIST);
+		test_htable_keys(HT_SWISS);
+		tested++;
+	}
+
+	if (strcmp(which_test, "all") == 0 || strcmp(which_test, "reserve") == 0) {
+		test_htable_reserve(HT_STRIPED);
+		test_htable_reserve(HT_SPLITLIST);
+		test_htable_reserve(HT_SWISS);
+		tested++;
+	}
+
+	if (strcmp(which_test, "all") == 0 || strcmp(which_test, "skew") == 0) {
+		test_htable_skew(HT_STRIPED);
 		tested++;
 	}
 
@@ -3,13 +3,16 @@
 #include <getopt.h>
 #include <assert.h>
 #include <pthread.h>
+#include <string.h>
 
 #include "htable.h"
+#include "hash.h"
 
 #define TESTSZ 1000000
 #define STRLEN 50
 
 extern int num_threads;
+extern int lock_stats;
 
 //a set of test keys
 static char testkeys[TESTSZ][STRLEN];
@@ -24,6 +27,10 @@ typedef enum {
 
 static op_type run_mode;
 int htest_allow_resize;
+static char htestname[100];
+//insert latencies (in ns) measured by thread 0 during the INSERT phase
+static long *insert_lat;
+static int n_insert_lat;
 
 void test_fatal(char *testname, char *errmsg);
 
@@ -42,6 +49,33 @@ set_random_str(char *s, int len)
 	s[len-1] = '\0';
 }
 
+static int
+cmp_long(const void *a, const void *b)
+{
+	long x = *(const long *)a, y = *(const long *)b;
+	return (x > y) - (x < y);
+}
+
+//print_insert_latency prints the median, 99th percentile and maximum insert latency
+static void
+print_insert_latency()
+{
+	if (n_insert_lat == 0) {
+		return;
+	}
+	qsort(insert_lat, n_insert_lat, sizeof(long), cmp_long);
+	printf("Insert latency of thread 0: p50 %ld ns, p99 %ld ns, max %ld ns\n",
+	       insert_lat[n_insert_lat/2], insert_lat[(long)n_insert_lat*99/100], insert_lat[n_insert_lat-1]);
+}
+
+//init_testkeys initializes testkeys
+static void
+init_testkeys()
+{
+	for (int i = 0; i < TESTSZ; i++) {
+		set_random_str(testkeys[i], STRLEN);
+	}
+}
 
 void *
 test_htable_run(void *arg)
@@ -54,7 +88,15 @@ test_htable_run(void *arg)
 		end = TESTSZ;
 
 	for (long i = thread_idx * share; i < end; i++) {
-	       	htable_insert(&ht, testkeys[i], &testvals[i]);
+		if (run_mode == INSERT && thread_idx == 0) {
+			struct timespec t0, t1;
+			clock_gettime(CLOCK_MONOTONIC, &t0);
+			htable_insert(&ht, testkeys[i], &testvals[i]);
+			clock_gettime(CLOCK_MONOTONIC, &t1);
+			insert_lat[n_insert_lat++] = (t1.tv_sec - t0.tv_sec)*1000000000L + (t1.tv_nsec - t0.tv_nsec);
+		} else {
+		       	htable_insert(&ht, testkeys[i], &testvals[i]);
+		}
 		//insert another randomly chosen key/val tuple
 		long r = (((thread_idx * i) % 256) * BIG_PRIME) % TESTSZ;
 		if (run_mode == INSERT) {
@@ -63,7 +105,6 @@ test_htable_run(void *arg)
 		       	void *v = htable_lookup(&ht, testkeys[r]);
 			if (v != NULL) {
 				if (v != &testvals[r]) {
-					char *htestname = htest_allow_resize? "RESIZE":"HTABLE";
 					test_fatal(htestname, "Concurrent lookup found that the existing tuple val does not match inserted.");
 				}
 			}
@@ -74,21 +115,24 @@ test_htable_run(void *arg)
 }
 
 void
-test_htable(int allow_resize)
+test_htable(int allow_resize, enum ht_backend backend)
 {
 	htest_allow_resize = allow_resize;
-	char *htestname = allow_resize? "RESIZE TEST":"HTABLE TEST";
+	snprintf(htestname, sizeof(htestname), "%s TEST (%s)", allow_resize? "RESIZE":"HTABLE",
+		 htable_backend_name(backend));
 	char errmsg[1000];
-	//initialize testkeys
-	for (int i = 0; i < TESTSZ; i++) {
-		set_random_str(testkeys[i], STRLEN);
+	init_testkeys();
+	htable_init_backend(&ht, TESTSZ/100, allow_resize, backend);
+	if (lock_stats) {
+		htable_lock_stats_enable(&ht);
 	}
-	htable_init(&ht, TESTSZ/100, allow_resize);
 	printf("Initialized hash table of size %d\n", htable_size(&ht));
 
 	pthread_t *threads = (pthread_t *)malloc(sizeof(pthread_t)*num_threads);
 
 	run_mode = INSERT;
+	insert_lat = (long *)malloc(sizeof(long)*TESTSZ);
+	n_insert_lat = 0;
 	struct timespec start, end;
 	clock_gettime(CLOCK_REALTIME, &start);
 	for (long i = 0; i < num_threads; i++) {
@@ -102,6 +146,8 @@ test_htable(int allow_resize)
 	clock_gettime(CLOCK_REALTIME, &end);
 	long duration = timediff(&start, &end);
 	printf("All %d threads finished. Throughput is %2f inserts/sec\n", num_threads, (double)2*TESTSZ/(double)duration);
+	print_insert_latency();
+	free(insert_lat);
 
 	//validate 
 	for (int i = 0; i < TESTSZ; i++) {
@@ -122,8 +168,14 @@ test_htable(int allow_resize)
 
 
 	//test a mix of insert and lookup operations
+	if (lock_stats) {
+		htable_lock_stats_print(&ht);
+	}
 	htable_destroy(&ht);
-	htable_init(&ht, TESTSZ/100, allow_resize);
+	htable_init_backend(&ht, TESTSZ/100, allow_resize, backend);
+	if (lock_stats) {
+		htable_lock_stats_enable(&ht);
+	}
 	run_mode = MIX;
 	clock_gettime(CLOCK_REALTIME, &start);
 	for (long i = 0; i < num_threads; i++) {
@@ -139,8 +191,310 @@ test_htable(int allow_resize)
 	printf("All %d threads finished. Throughput is %2f lookups/sec\n", num_threads, (double)2*TESTSZ/(double)duration);
 
 	int sz = htable_size(&ht);
+	if (lock_stats) {
+		htable_lock_stats_print(&ht);
+	}
 	htable_destroy(&ht);
 	printf("--- %s PASSED (final htable size %d) \n", htestname, sz);
 	// clear up the threads array that we malloced earlier
 	free(threads);
 }
+
+//test_htable_batch bulk-loads all test keys with htable_insert_batch
+void
+test_htable_batch(enum ht_backend backend)
+{
+	snprintf(htestname, sizeof(htestname), "BATCH TEST (%s)", htable_backend_name(backend));
+	char errmsg[1000];
+	init_testkeys();
+	char **keys = (char **)malloc(sizeof(char *)*TESTSZ);
+	void **vals = (void **)malloc(sizeof(void *)*TESTSZ);
+	for (int i = 0; i < TESTSZ; i++) {
+		keys[i] = testkeys[i];
+		vals[i] = &testvals[i];
+	}
+
+	struct timespec start, end;
+	clock_gettime(CLOCK_REALTIME, &start);
+	htable_init_backend(&ht, 0, 1, backend);
+	int dups = htable_insert_batch(&ht, keys, vals, TESTSZ);
+	clock_gettime(CLOCK_REALTIME, &end);
+	printf("Loaded %d tuples in %ld usec (final htable size %d)\n", TESTSZ, timediff(&start, &end), htable_size(&ht));
+	if (dups != 0) {
+		snprintf(errmsg, 1000, "htable_insert_batch found %d existing keys in an empty htable", dups);
+		test_fatal(htestname, errmsg);
+	}
+
+	//validate
+	for (int i = 0; i < TESTSZ; i++) {
+		void *p = htable_lookup(&ht, testkeys[i]);
+		if (p != &testvals[i]) {
+			snprintf(errmsg, 1000, "htable has wrong value (%p) for key %s value %p tuple", p, testkeys[i], &testvals[i]);
+			test_fatal(htestname, errmsg);
+		}
+	}
+	//loading the same keys again must not insert anything
+	dups = htable_insert_batch(&ht, keys, vals, TESTSZ/10);
+	if (dups != TESTSZ/10) {
+		snprintf(errmsg, 1000, "htable_insert_batch inserted %d existing keys again", TESTSZ/10 - dups);
+		test_fatal(htestname, errmsg);
+	}
+	htable_destroy(&ht);
+	free(keys);
+	free(vals);
+	printf("--- %s PASSED\n", htestname);
+}
+
+//reserve_done tells the reserving thread of test_htable_reserve that the inserts are over
+static int reserve_done;
+
+//test_reserve_run inserts the thread's share of the test keys
+void *
+test_reserve_run(void *arg)
+{
+	long thread_idx = (long)arg;
+	int share = TESTSZ / num_threads;
+	int end = (thread_idx+1)*share;
+	if (thread_idx == (num_threads -1)) 
+		end = TESTSZ;
+	for (long i = thread_idx * share; i < end; i++) {
+		htable_insert(&ht, testkeys[i], &testvals[i]);
+	}
+	return NULL;
+}
+
+//test_reserver_run keeps reserving less room than the htable already has, which finishes
+//at once the resizes that the inserts start
+void *
+test_reserver_run(void *arg)
+{
+	while (!__atomic_load_n(&reserve_done, __ATOMIC_ACQUIRE)) {
+		htable_reserve(&ht, 1);
+	}
+	return NULL;
+}
+
+//test_htable_reserve runs htable_reserve alongside inserts that resize the htable
+void
+test_htable_reserve(enum ht_backend backend)
+{
+	snprintf(htestname, sizeof(htestname), "RESERVE TEST (%s)", htable_backend_name(backend));
+	char errmsg[1000];
+	init_testkeys();
+	htable_init_backend(&ht, 0, 1, backend);
+	pthread_t *threads = (pthread_t *)malloc(sizeof(pthread_t)*num_threads);
+	pthread_t reserver;
+	reserve_done = 0;
+	assert(pthread_create(&reserver, NULL, test_reserver_run, NULL) == 0);
+	for (long i = 0; i < num_threads; i++) {
+		assert(pthread_create(&threads[i], NULL, test_reserve_run, (void *)i) == 0);
+	}
+	for (long i = 0; i < num_threads; i++) {
+		pthread_join(threads[i], NULL);
+	}
+	__atomic_store_n(&reserve_done, 1, __ATOMIC_RELEASE);
+	pthread_join(reserver, NULL);
+
+	//validate
+	for (int i = 0; i < TESTSZ; i++) {
+		void *p = htable_lookup(&ht, testkeys[i]);
+		if (p != &testvals[i]) {
+			snprintf(errmsg, 1000, "htable has wrong value (%p) for key %s value %p tuple", p, testkeys[i], &testvals[i]);
+			test_fatal(htestname, errmsg);
+		}
+	}
+	int sz = htable_size(&ht);
+	htable_destroy(&ht);
+	free(threads);
+	printf("--- %s PASSED (final htable size %d)\n", htestname, sz);
+}
+
+//test_htable_skew inserts SKEWSZ keys of SKEWLEN characters, all into the same stripe
+#define SKEWSZ 2000
+#define SKEWLEN 16
+
+//test_htable_skew inserts keys that all hash to one stripe of the striped backend: the
+//other stripes never take part in a resize, but the htable must still keep doubling
+void
+test_htable_skew(enum ht_backend backend)
+{
+	snprintf(htestname, sizeof(htestname), "SKEW TEST (%s)", htable_backend_name(backend));
+	char errmsg[1000];
+	for (int i = 0; i < SKEWSZ; i++) {
+		do {
+			set_random_str(testkeys[i], SKEWLEN+1);
+		} while ((hash_bytes(testkeys[i], SKEWLEN) & (HT_STRIPES - 1)) != 0);
+	}
+	htable_init_backend(&ht, 0, 1, backend);
+	int init_sz = htable_size(&ht);
+	for (int i = 0; i < SKEWSZ; i++) {
+		htable_insert(&ht, testkeys[i], &testvals[i]);
+	}
+	//validate
+	for (int i = 0; i < SKEWSZ; i++) {
+		void *p = htable_lookup(&ht, testkeys[i]);
+		if (p != &testvals[i]) {
+			snprintf(errmsg, 1000, "htable has wrong value (%p) for key %s value %p tuple", p, testkeys[i], &testvals[i]);
+			test_fatal(htestname, errmsg);
+		}
+	}
+	int sz = htable_size(&ht);
+	if (sz < 4*init_sz) {
+		snprintf(errmsg, 1000, "htable grew from %d to only %d slots for %d keys", init_sz, sz, SKEWSZ);
+		test_fatal(htestname, errmsg);
+	}
+	htable_destroy(&ht);
+	printf("--- %s PASSED (final htable size %d)\n", htestname, sz);
+}
+
+//churn_present[i] tells if testkeys[i] is in the htable during test_htable_churn
+static char churn_present[TESTSZ];
+
+//test_churn_run runs a mix of inserts, removes and lookups. Thread thread_idx only
+//inserts and removes its own share of the keys, so it knows which of them are present;
+//it also looks up keys of other threads, which must either be absent or have the right val.
+void *
+test_churn_run(void *arg)
+{
+	long thread_idx = (long)arg;
+	int share = TESTSZ / num_threads;
+	int start = thread_idx * share;
+	int end = (thread_idx+1)*share;
+	if (thread_idx == (num_threads -1)) 
+		end = TESTSZ;
+	unsigned int seed = thread_idx + 1;
+	char errmsg[1000];
+
+	for (int i = 0; i < 2*TESTSZ/num_threads; i++) {
+		int k = start + rand_r(&seed) % (end - start);
+		int r;
+		void *v;
+		switch (rand_r(&seed) % 4) {
+			case 0:
+				r = htable_insert(&ht, testkeys[k], &testvals[k]);
+				if (r != churn_present[k]) {
+					snprintf(errmsg, 1000, "insert of key %s returned %d", testkeys[k], r);
+					test_fatal(htestname, errmsg);
+				}
+				churn_present[k] = 1;
+				break;
+			case 1:
+				r = htable_remove(&ht, testkeys[k]);
+				if (r != !churn_present[k]) {
+					snprintf(errmsg, 1000, "remove of key %s returned %d", testkeys[k], r);
+					test_fatal(htestname, errmsg);
+				}
+				churn_present[k] = 0;
+				break;
+			case 2:
+				v = htable_lookup(&ht, testkeys[k]);
+				if (v != (churn_present[k] ? &testvals[k] : NULL)) {
+					snprintf(errmsg, 1000, "lookup of key %s found %p", testkeys[k], v);
+					test_fatal(htestname, errmsg);
+				}
+				break;
+			default:
+				k = rand_r(&seed) % TESTSZ;
+				v = htable_lookup(&ht, testkeys[k]);
+				if (v != NULL && v != &testvals[k]) {
+					test_fatal(htestname, "Concurrent lookup found that the existing tuple val does not match inserted.");
+				}
+		}
+	}
+	return NULL;
+}
+
+//test_htable_churn measures a mix of inserts, removes and lookups on a half full htable
+void
+test_htable_churn(enum ht_backend backend)
+{
+	snprintf(htestname, sizeof(htestname), "CHURN TEST (%s)", htable_backend_name(backend));
+	char errmsg[1000];
+	init_testkeys();
+	htable_init_backend(&ht, TESTSZ/100, 1, backend);
+	if (lock_stats) {
+		htable_lock_stats_enable(&ht);
+	}
+	for (int i = 0; i < TESTSZ; i++) {
+		churn_present[i] = (i % 2 == 0);
+		if (churn_present[i]) {
+			htable_insert(&ht, testkeys[i], &testvals[i]);
+		}
+	}
+
+	pthread_t *threads = (pthread_t *)malloc(sizeof(pthread_t)*num_threads);
+	struct timespec start, end;
+	clock_gettime(CLOCK_REALTIME, &start);
+	for (long i = 0; i < num_threads; i++) {
+		assert(pthread_create(&threads[i], NULL, test_churn_run, (void *)i) == 0);
+	}
+	printf("Spawned %d threads, each to insert, remove or lookup %d tuples\n", num_threads, 2*TESTSZ/num_threads);
+	for (long i = 0; i < num_threads; i++) {
+		pthread_join(threads[i], NULL);
+	}
+	clock_gettime(CLOCK_REALTIME, &end);
+	long duration = timediff(&start, &end);
+	printf("All %d threads finished. Throughput is %2f ops/sec\n", num_threads, (double)2*TESTSZ/(double)duration);
+
+	//validate
+	for (int i = 0; i < TESTSZ; i++) {
+		void *p = htable_lookup(&ht, testkeys[i]);
+		if (p != (churn_present[i] ? &testvals[i] : NULL)) {
+			snprintf(errmsg, 1000, "htable has wrong value (%p) for key %s, present %d", p, testkeys[i], churn_present[i]);
+			test_fatal(htestname, errmsg);
+		}
+	}
+	if (lock_stats) {
+		htable_lock_stats_print(&ht);
+	}
+	htable_destroy(&ht);
+	free(threads);
+	printf("--- %s PASSED\n", htestname);
+}
+
+//test_htable_keys checks keys around the inline key size: all keys are prefixes of the
+//same string, so they differ only in length, and they are looked up with copies of
+//the inserted strings
+void
+test_htable_keys(enum ht_backend backend)
+{
+	snprintf(htestname, sizeof(htestname), "KEYS TEST (%s)", htable_backend_name(backend));
+	char errmsg[1000];
+	char base[2*HT_INLINE_KEY + 2];
+	set_random_str(base, sizeof(base));
+	int n = sizeof(base);
+	char **keys = (char **)malloc(sizeof(char *)*n);
+	htable_init_backend(&ht, 0, 1, backend);
+	for (int i = 0; i < n; i++) {
+		keys[i] = strndup(base, i);
+		if (htable_insert(&ht, keys[i], &testvals[i]) != 0) {
+			snprintf(errmsg, 1000, "key of length %d found before it was inserted", i);
+			test_fatal(htestname, errmsg);
+		}
+	}
+	//remove every other key
+	for (int i = 0; i < n; i += 2) {
+		char *copy = strndup(base, i);
+		if (htable_remove(&ht, copy) != 0) {
+			snprintf(errmsg, 1000, "failed to remove key of length %d", i);
+			test_fatal(htestname, errmsg);
+		}
+		free(copy);
+	}
+	//validate
+	for (int i = 0; i < n; i++) {
+		char *copy = strndup(base, i);
+		void *p = htable_lookup(&ht, copy);
+		if (p != ((i % 2) ? &testvals[i] : NULL)) {
+			snprintf(errmsg, 1000, "htable has wrong value (%p) for key of length %d", p, i);
+			test_fatal(htestname, errmsg);
+		}
+		free(copy);
+	}
+	htable_destroy(&ht);
+	for (int i = 0; i < n; i++) {
+		free(keys[i]);
+	}
+	free(keys);
+	printf("--- %s PASSED\n", htestname);
+}
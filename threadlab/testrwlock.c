@@ -1,15 +1,19 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <assert.h>
 #include <math.h>
 #include <time.h>
 #include <errno.h>
 #include <pthread.h>
 #include <unistd.h>
+#include <sched.h>
 
 #include "rwlock.h"
+#include "tid.h"
 
 extern int num_threads;
+extern int lock_stats;
 
 //global variable for the test_rwl_basic
 static rwl l1;
@@ -21,6 +25,33 @@ static int who_is_in_cs = 0;
 static int reader_getout = 0;
 static int peers_getout = 0;
 
+//globals for test_rwl_upgrade
+static rwl l4;
+static int upgrade_reader_in = 0;
+
+//globals for test_rwl_many_readers, which runs more readers than there are thread indexes
+#define MANY_READERS (TID_MAX + 16)
+static rwl l5;
+static pthread_barrier_t many_in; //all readers hold l5
+static pthread_barrier_t many_out; //the readers may leave
+
+//globals for test_rwl_many_waiters, which queues more readers and writers on a lock than
+//its state can count as waiting, and more readers than it can count as holding it
+#define MANY_WAITERS 600
+static rwl l6;
+static int many_started = 0;
+static int many_readers_in = 0;
+static int many_writer_in = 0;
+static int many_broken = 0;
+
+//globals for test_rwl_handoff
+#define HANDOFF_ITERS 100000
+static rwl l3;
+static long last_owner = -1; //the thread that released l3 last
+static long last_release; //when it did, in ns
+static long handoff_ns;
+static long n_handoffs;
+
 static char *rwltest = "RWLOCK TEST";
 
 pthread_mutex_t test_m;
@@ -221,3 +252,244 @@ test_rwl_priority()
 
 }
 
+
+static inline long
+now_ns()
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec*1000000000L + t.tv_nsec;
+}
+
+//handoff_writer takes l3 in write mode over and over. When it gets l3 from another
+//thread, it adds the time since that thread released it to handoff_ns
+void *
+handoff_writer(void *arg)
+{
+	long me = (long)arg;
+	for (int i = 0; i < HANDOFF_ITERS; i++) {
+		rwl_wlock(&l3, NULL);
+		if (last_owner >= 0 && last_owner != me) {
+			handoff_ns += now_ns() - last_release;
+			n_handoffs++;
+		}
+		last_owner = me;
+		//give the others time to queue up behind this writer
+		sched_yield();
+		last_release = now_ns();
+		rwl_wunlock(&l3);
+		//let the others in, even if they all run on this CPU
+		sched_yield();
+	}
+	return NULL;
+}
+
+//test_rwl_handoff measures how long it takes a contended lock to go from one writer
+//to the next, and how many write locks per second num_threads writers get
+void
+test_rwl_handoff()
+{
+	int n = num_threads < 2 ? 2 : num_threads;
+	pthread_t *threads = (pthread_t *)malloc(sizeof(pthread_t)*n);
+	rwl_init(&l3);
+	if (lock_stats) {
+		rwl_stats_enable(&l3);
+	}
+	long start = now_ns();
+	for (long i = 0; i < n; i++) {
+		assert(pthread_create(&threads[i], NULL, handoff_writer, (void *)i) == 0);
+	}
+	for (int i = 0; i < n; i++) {
+		pthread_join(threads[i], NULL);
+	}
+	long duration = now_ns() - start;
+	if (lock_stats) {
+		rwl_stats st;
+		memset(&st, 0, sizeof(st));
+		rwl_stats_get(&l3, &st);
+		rwl_stats_print("Handoff lock", &st);
+	}
+	rwl_destroy(&l3);
+	free(threads);
+	printf("%d writers: %.0f write locks/sec, %ld handoffs, average handoff latency %ld ns\n",
+	       n, (double)n*HANDOFF_ITERS*1e9/duration, n_handoffs, n_handoffs ? handoff_ns/n_handoffs : 0);
+	printf("--- %s PASSED (lock handoff)\n", rwltest);
+}
+
+void *
+many_reader(void *arg)
+{
+	if (rwl_rlock(&l5, NULL) != 0) {
+		test_fatal(rwltest, "Reader failed to lock!");
+	}
+	pthread_barrier_wait(&many_in);
+	pthread_barrier_wait(&many_out);
+	rwl_runlock(&l5);
+	return NULL;
+}
+
+//test_rwl_many_readers checks that the readers without a thread index (and so without
+//reader slots) still share the lock and keep the writers out
+void
+test_rwl_many_readers()
+{
+	struct timespec expire;
+	pthread_t *threads = (pthread_t *)malloc(sizeof(pthread_t)*MANY_READERS);
+
+	rwl_init(&l5);
+	pthread_barrier_init(&many_in, NULL, MANY_READERS + 1);
+	pthread_barrier_init(&many_out, NULL, MANY_READERS + 1);
+	for (long i = 0; i < MANY_READERS; i++) {
+		assert(pthread_create(&threads[i], NULL, many_reader, NULL) == 0);
+	}
+	pthread_barrier_wait(&many_in);
+	get_expiretime(&expire);
+	if (rwl_wlock(&l5, &expire) != ETIMEDOUT) {
+		test_fatal(rwltest, "A writer should not be able to lock while readers are there");
+	}
+	pthread_barrier_wait(&many_out);
+	for (long i = 0; i < MANY_READERS; i++) {
+		pthread_join(threads[i], NULL);
+	}
+	get_expiretime(&expire);
+	if (rwl_wlock(&l5, &expire) != 0) {
+		test_fatal(rwltest, "Writer failed to lock after all readers left");
+	}
+	rwl_wunlock(&l5);
+	rwl_destroy(&l5);
+	pthread_barrier_destroy(&many_in);
+	pthread_barrier_destroy(&many_out);
+	free(threads);
+	printf("--- %s PASSED (%d readers)\n", rwltest, MANY_READERS);
+}
+
+//many_waiter takes l6 in write mode if arg is a multiple of 3, in read mode otherwise,
+//and checks that no writer shares it
+void *
+many_waiter(void *arg)
+{
+	long i = (long)arg;
+	__atomic_add_fetch(&many_started, 1, __ATOMIC_SEQ_CST);
+	if (i % 3 == 0) {
+		rwl_wlock(&l6, NULL);
+		if (__atomic_load_n(&many_readers_in, __ATOMIC_SEQ_CST) > 0 || many_writer_in) {
+			many_broken = 1;
+		}
+		many_writer_in = 1;
+		sched_yield();
+		many_writer_in = 0;
+		rwl_wunlock(&l6);
+	} else {
+		rwl_rlock(&l6, NULL);
+		__atomic_add_fetch(&many_readers_in, 1, __ATOMIC_SEQ_CST);
+		if (many_writer_in) {
+			many_broken = 1;
+		}
+		sched_yield();
+		__atomic_sub_fetch(&many_readers_in, 1, __ATOMIC_SEQ_CST);
+		rwl_runlock(&l6);
+	}
+	return NULL;
+}
+
+//test_rwl_many_waiters checks that the lock still excludes writers, and lets everyone
+//through, when MANY_WAITERS writers and twice as many readers queue up on it at once
+void
+test_rwl_many_waiters()
+{
+	int n = 3*MANY_WAITERS;
+	pthread_t *threads = (pthread_t *)malloc(sizeof(pthread_t)*n);
+
+	rwl_init(&l6);
+	rwl_wlock(&l6, NULL);
+	for (long i = 0; i < n; i++) {
+		assert(pthread_create(&threads[i], NULL, many_waiter, (void *)i) == 0);
+	}
+	while (__atomic_load_n(&many_started, __ATOMIC_SEQ_CST) < n) {
+		sched_yield();
+	}
+	//let the last ones get to waiting
+	usleep(100000);
+	rwl_wunlock(&l6);
+	for (int i = 0; i < n; i++) {
+		pthread_join(threads[i], NULL);
+	}
+	if (many_broken) {
+		test_fatal(rwltest, "A writer shared the lock");
+	}
+	if (rwl_nwaiters(&l6) != 0) {
+		test_fatal(rwltest, "Threads are still counted as waiting after all got the lock");
+	}
+	rwl_destroy(&l6);
+	free(threads);
+	printf("--- %s PASSED (%d waiters)\n", rwltest, n);
+}
+
+void *
+upgrade_reader(void *arg)
+{
+	//readers share the lock with the intent holder
+	if (rwl_rlock(&l4, NULL) != 0) {
+		test_fatal(rwltest, "Reader failed to lock alongside the intent holder");
+	}
+	__atomic_store_n(&upgrade_reader_in, 1, __ATOMIC_RELEASE);
+	usleep(1000);
+	rwl_runlock(&l4);
+	return NULL;
+}
+
+void
+test_rwl_upgrade()
+{
+	struct timespec expire;
+	pthread_t reader;
+
+	rwl_init(&l4);
+	if (rwl_ulock(&l4, NULL) != 0) {
+		test_fatal(rwltest, "Intent locker failed to lock!");
+	}
+	get_expiretime(&expire);
+	if (rwl_ulock(&l4, &expire) != ETIMEDOUT) {
+		test_fatal(rwltest, "Another intent locker should not be able to lock");
+	}
+	get_expiretime(&expire);
+	if (rwl_wlock(&l4, &expire) != ETIMEDOUT) {
+		test_fatal(rwltest, "A writer should not be able to lock while the intent holder is there");
+	}
+
+	assert(pthread_create(&reader, NULL, upgrade_reader, NULL) == 0);
+	while (!__atomic_load_n(&upgrade_reader_in, __ATOMIC_ACQUIRE));
+	get_expiretime(&expire);
+	if (rwl_upgrade(&l4, &expire) != ETIMEDOUT) {
+		test_fatal(rwltest, "Intent holder should not be able to upgrade while a reader is there");
+	}
+	//the upgrade waits for the reader to leave
+	if (rwl_upgrade(&l4, NULL) != 0) {
+		test_fatal(rwltest, "Intent holder failed to upgrade");
+	}
+	printf("Intent holder upgraded once the reader left\n");
+	pthread_join(reader, NULL);
+	get_expiretime(&expire);
+	if (rwl_rlock(&l4, &expire) != ETIMEDOUT) {
+		test_fatal(rwltest, "A reader should not be able to lock after the upgrade");
+	}
+
+	rwl_downgrade(&l4);
+	get_expiretime(&expire);
+	if (rwl_rlock(&l4, &expire) != 0) {
+		test_fatal(rwltest, "Another reader should be able to lock after the downgrade");
+	}
+	get_expiretime(&expire);
+	if (rwl_wlock(&l4, &expire) != ETIMEDOUT) {
+		test_fatal(rwltest, "A writer should not be able to lock after the downgrade");
+	}
+	rwl_runlock(&l4);
+	rwl_runlock(&l4);
+	printf("Writer downgraded to a reader\n");
+	if (rwl_wlock(&l4, NULL) != 0) {
+		test_fatal(rwltest, "Writer failed to lock!");
+	}
+	rwl_wunlock(&l4);
+	rwl_destroy(&l4);
+	printf("--- %s PASSED (upgrade and downgrade)\n", rwltest);
+}
@@ -0,0 +1,64 @@
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "tid.h"
+
+/* tid gives each thread a small index (below TID_MAX) the first time it asks for one,
+ * and takes it back when the thread exits, so that short-lived threads do not use up
+ * the indexes. Per-thread arrays (epoch slots, reader indicators) are indexed by it.
+ * A thread that finds all indexes taken gets TID_NONE, for good, and its callers fall
+ * back to a shared path: a library must not stop the program for having many threads.
+ */
+
+static pthread_mutex_t tid_m = PTHREAD_MUTEX_INITIALIZER;
+static int tid_used[TID_MAX];
+static pthread_key_t tid_key;
+static int tid_key_ok;
+static pthread_once_t tid_once = PTHREAD_ONCE_INIT;
+static __thread int my_tid = -2; //-2 until the thread first asks for an index
+
+//release_tid gives the index of an exiting thread back
+static void
+release_tid(void *arg)
+{
+	int tid = (int)(long)arg - 1;
+	pthread_mutex_lock(&tid_m);
+	tid_used[tid] = 0;
+	pthread_mutex_unlock(&tid_m);
+}
+
+static void
+make_tid_key()
+{
+	tid_key_ok = (pthread_key_create(&tid_key, release_tid) == 0);
+}
+
+//tid_get returns the index of the calling thread, or TID_NONE if it has none
+int
+tid_get()
+{
+	if (my_tid != -2) {
+		return my_tid;
+	}
+	my_tid = TID_NONE;
+	pthread_once(&tid_once, make_tid_key);
+	//without the key, the indexes of exiting threads could not be given back
+	if (!tid_key_ok) {
+		return my_tid;
+	}
+	pthread_mutex_lock(&tid_m);
+	for (int i = 0; i < TID_MAX; i++) {
+		if (!tid_used[i]) {
+			tid_used[i] = 1;
+			my_tid = i;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&tid_m);
+	//the key's value must not be NULL for the destructor to run
+	if (my_tid != TID_NONE && pthread_setspecific(tid_key, (void *)(long)(my_tid + 1)) != 0) {
+		release_tid((void *)(long)(my_tid + 1));
+		my_tid = TID_NONE;
+	}
+	return my_tid;
+}
@@ -0,0 +1,12 @@
+#ifndef TID_H
+#define TID_H
+
+//maximum number of threads that can hold a thread index at the same time
+#define TID_MAX 128
+
+//tid_get returns this instead of an index when TID_MAX threads already hold one
+#define TID_NONE (-1)
+
+int tid_get();
+
+#endif